@@ -12,6 +12,10 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers come from a slab cache. The cache grows to NBUF
+// buffers, and past that only while every buffer is in use;
+// the extra buffers are freed again as they are released.
 
 
 #include "types.h"
@@ -22,10 +26,15 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "rusage.h"
+#include "proc.h"
+#include "lockstat.h"
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kcache *cache;
+  struct lockstat *lockstat; // for the buffers' sleep locks
+  int nbuf;
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -36,20 +45,33 @@ struct {
 void
 binit(void)
 {
-  struct buf *b;
-
-  initlock(&bcache.lock, "bcache");
+  initticketlock(&bcache.lock, "bcache");
+  bcache.cache = kcachecreate("buf", sizeof(struct buf));
+  bcache.lockstat = lockregister("buffer", LOCK_SLEEP);
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+}
+
+// Allocate a new buffer and put it at the head of the list.
+// Caller must hold bcache.lock.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  if((b = kcachealloc(bcache.cache)) == 0)
+    return 0;
+  b->disk = 0;
+  b->refcnt = 0;
+  initsleeplockstat(&b->lock, "buffer", bcache.lockstat);
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -73,19 +95,24 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Allocate a new buffer until there are NBUF, then recycle
+  // the least recently used (LRU) unused buffer, and if all
+  // are in use, allocate another.
+  b = &bcache.head;
+  if(bcache.nbuf >= NBUF){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev)
+      if(b->refcnt == 0)
+        break;
   }
-  panic("bget: no buffers");
+  if(b == &bcache.head && (b = bnew()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,6 +125,8 @@ bread(uint dev, uint blockno)
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    if(myproc())
+      myproc()->ru.inblock++;
   }
   return b;
 }
@@ -109,6 +138,8 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   virtio_disk_rw(b, 1);
+  if(myproc())
+    myproc()->ru.oublock++;
 }
 
 // Release a locked buffer.
@@ -123,7 +154,13 @@ brelse(struct buf *b)
 
   acquire(&bcache.lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
+  if (b->refcnt == 0 && bcache.nbuf > NBUF) {
+    // an extra buffer from when all were in use.
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    bcache.nbuf--;
+    kcachefree(bcache.cache, b);
+  } else if (b->refcnt == 0) {
     // no one is waiting for it.
     b->next->prev = b->prev;
     b->prev->next = b->next;
@@ -2,12 +2,17 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kcache;
+struct lockstat;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdata;
 
 // bio.c
 void            binit(void);
@@ -30,9 +35,16 @@ struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
-int             fileread(struct file*, uint64, int n);
+int             fileread(struct file*, int, uint64, int n);
 int             filestat(struct file*, uint64 addr);
-int             filewrite(struct file*, uint64, int n);
+int             filewrite(struct file*, int, uint64, int n);
+int             filesplice(struct file*, struct file*, int);
+int             filetee(struct file*, struct file*, int);
+int             filecopy(struct file*, struct file*, int);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
 
 // fs.c
 void            fsinit(int);
@@ -50,6 +62,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+struct buf*     iblock(struct inode*, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -57,8 +70,22 @@ void            ireclaim(int);
 
 // kalloc.c
 void*           kalloc(void);
+int             kallocn(void**, int);
+void*           kallocmega(void);
+void*           kallocorder(int);
 void            kfree(void *);
 void            kinit(void);
+void            krefinc(void *);
+int             kmemstat(uint64);
+int             kmemstress(int, int);
+
+// lockstat.c
+struct lockstat* lockregister(char*, int);
+void            lockcontended(struct lockstat*, uint64);
+void            lockhold(struct lockstat*, uint64);
+int             lockstat(uint64, int);
+void            lockbenchinit(void);
+int             lockbench(int, int, uint64);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -66,21 +93,57 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+uint64          kmmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
+uint64          mmapfile(uint64, uint64, int, int, struct file*, int);
+uint64          kmunmap(uint64 addr, int length);
+uint64          kmsync(uint64 addr, int length);
+uint64          mmapfault(struct proc*, uint64, int);
+int             mmapcopy(struct proc*, struct proc*);
+void            mmapclose(struct proc*);
+void            mmapfree(struct proc*);
+
+// pagecache.c
+void            pcinit(void);
+uint64          pcget(struct inode*, uint);
+int             pcput(uint64);
+int             pcdup(uint64);
+void            pcdirty(uint64);
+int             pcsync(struct inode*, uint, uint);
+void            pcupdate(struct inode*, uint, char*, uint, uint64);
+void            pcinval(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+int             pipefill(struct pipe*, struct file*, int);
+int             pipedrain(struct pipe*, struct file*, int, int);
+int             pipesize(struct pipe*, int);
 
 // printf.c
 int             printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+void            profinit(void);
+void            proftick(uint64);
+uint64          profnext(void);
+int             profctl(int, int);
+int             profread(uint64, int);
+
 // proc.c
 int             cpuid(void);
+void            tlbshootdown(pagetable_t);
 void            kexit(int);
 int             kfork(void);
+int             kclone(uint64, uint64, uint64);
+int             kjoin(int, uint64);
+int             hasthreads(struct proc*);
+int             kfutex(uint64, int, int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -102,6 +165,24 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             cpuidle(uint64, int);
+int             kwait3(uint64, uint64);
+int             kgetrusage(int, uint64);
+
+// shm.c
+void            shminit(void);
+struct file*    shmopen(char*, int, int);
+void            shmclose(struct shm*);
+int             shmunlink(char*);
+uint64          shmpage(struct shm*, uint);
+void*           shmcontig(struct shm*);
+
+// slab.c
+void            slabinit(void);
+struct kcache*  kcachecreate(char*, int);
+void*           kcachealloc(struct kcache*);
+void            kcachefree(struct kcache*, void*);
+int             slabstat(uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -110,6 +191,8 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlockstat(struct spinlock*, char*, struct lockstat*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -119,6 +202,7 @@ void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initsleeplockstat(struct sleeplock*, char*, struct lockstat*);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -137,6 +221,17 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+int             fdfile(int, struct file**);
+void            uringclose(struct proc*);
+
+// timer.c
+extern uint64   quantum;
+void            timerqinit(void);
+int             timersleep(uint64);
+void            timerexpire(uint64);
+uint64          timernext(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -159,7 +254,9 @@ int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmsplit(pagetable_t, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -170,6 +267,9 @@ int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 int             ismapped(pagetable_t, uint64);
 uint64          vmfault(pagetable_t, uint64, int);
+int             mapmega(pagetable_t, uint64, uint64, int);
+uint64          zeromap(pagetable_t, uint64, int);
+uint64          zerocopy(pte_t*);
 
 // plic.c
 void            plicinit(void);
@@ -177,13 +277,16 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vdata.c
+extern struct vdata *vdata;
+uint64          rtcread(void);
+void            vdatainit(void);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
 
-uint64          kmmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
-uint64          kmunmap(uint64 addr, int length);
 
 uint64 freemem(void);
 
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
@@ -32,6 +33,10 @@ kexec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  // the old image can't go while other threads run in it.
+  if(p->leader != p || hasthreads(p))
+    return -1;
+
   begin_op();
 
   // Open the executable file.
@@ -131,11 +136,6 @@ kexec(char *path, char **argv)
   sp = sz;
   stackbase = sp - USERSTACK*PGSIZE;
 
-  // Initialize mmap region: place it just below the trapframe/stack region.
-  // mmap_base is the top (exclusive) of the mmap area; mmap_next grows downward.
-  p->mmap_base = TRAPFRAME - (USERSTACK * PGSIZE);
-  p->mmap_next = p->mmap_base;
-          
 
   // Copy arguments into stack
   for(argc = 0; argv[argc]; argc++){
@@ -165,6 +165,10 @@ kexec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
 
+  // the new image starts with no mappings.
+  p->mmap_base = MMAPBASE;
+  mmapclose(p);
+  uringclose(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
@@ -9,38 +9,41 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "buf.h"
 #include "file.h"
 #include "stat.h"
+#include "uio.h"
+#include "rusage.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// Files come from a slab cache, so there is no limit on open
+// files other than memory. ftable.lock protects the ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kcachecreate("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kcachealloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,6 +75,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kcachefree(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -79,6 +83,8 @@ fileclose(struct file *f)
     begin_op();
     iput(ff.ip);
     end_op();
+  } else if(ff.type == FD_SHM){
+    shmclose(ff.shm);
   }
 }
 
@@ -102,9 +108,10 @@ filestat(struct file *f, uint64 addr)
 }
 
 // Read from file f.
-// addr is a user virtual address.
+// If user_dst==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-fileread(struct file *f, uint64 addr, int n)
+fileread(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,16 +119,18 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
+  } else if(f->type == FD_SHM){
+    r = -1;   // use mmap()
   } else {
     panic("fileread");
   }
@@ -129,52 +138,290 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Write n bytes at addr to ip starting at *off, advancing *off.
+static int
+inodewrite(struct inode *ip, int user_src, uint64 addr, uint *off, int n)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, r = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(ip);
+    if ((r = writei(ip, user_src, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_op();
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
-// addr is a user virtual address.
+// If user_src==1, then addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewrite(struct file *f, int user_src, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+    ret = inodewrite(f->ip, user_src, addr, &f->off, n);
+  } else if(f->type == FD_SHM){
+    ret = -1;   // use mmap()
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+
+// Move up to n bytes from in to out inside the kernel.
+// One of them must be a pipe.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_PIPE){
+    if(out->type == FD_PIPE && out->pipe == in->pipe)
+      return -1;
+    return pipedrain(in->pipe, out, n, 1);
+  }
+  if(out->type == FD_PIPE)
+    return pipefill(out->pipe, in, n);
+  return -1;
+}
+
+// Copy up to n bytes from pipe in to pipe out, leaving
+// them in in.
+int
+filetee(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_PIPE || out->type != FD_PIPE || in->pipe == out->pipe)
+    return -1;
+  return pipedrain(in->pipe, out, n, 0);
+}
+
+// Is ip a regular file? Its type can't change while the
+// caller holds a reference to it.
+static int
+isfile(struct inode *ip)
+{
+  int r;
+
+  ilock(ip);
+  r = ip->type == T_FILE;
+  iunlock(ip);
+  return r;
+}
+
+// Lock two distinct inodes in a fixed (address) order, so that
+// two filecopy()s in opposite directions can't deadlock.
+// Both must be regular files: namei() and create() lock a
+// directory before its entries, and address order could
+// invert that.
+static void
+ilock2(struct inode *a, struct inode *b)
+{
+  if(a < b){
+    ilock(a);
+    ilock(b);
+  } else {
+    ilock(b);
+    ilock(a);
+  }
+}
+
+// Copy up to n bytes from file in to file out inside the kernel,
+// advancing both offsets. Data goes straight from in's buffer
+// cache blocks to out, never through user memory. in must be a
+// regular file; out may be a regular file or a device. If either is a pipe,
+// this is splice(). Returns the number of bytes copied, which
+// is short at end of file.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  // as in filewrite(), stay within one log transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int total = 0, err = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_PIPE || out->type == FD_PIPE)
+    return filesplice(in, out, n);
+  if(in->type != FD_INODE || !isfile(in->ip))
+    return -1;
+  if(out->type == FD_DEVICE){
+    if(out->major < 0 || out->major >= NDEV || !devsw[out->major].write)
+      return -1;
+  } else if(out->type != FD_INODE || out->ip == in->ip || !isfile(out->ip)){
+    return -1;
+  }
+
+  while(total < n && !err){
+    int n1 = n - total, i, m, w;
+    struct buf *bp;
 
+    if(n1 > max)
+      n1 = max;
+    if(out->type == FD_INODE){
       begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+      ilock2(in->ip, out->ip);
+    } else {
+      ilock(in->ip);
+    }
 
-      if(r != n1){
-        // error from writei
+    for(i = 0; i < n1; i += m){
+      if((bp = iblock(in->ip, in->off)) == 0)
+        break;
+      m = n1 - i;
+      if(m > BSIZE - in->off % BSIZE)
+        m = BSIZE - in->off % BSIZE;
+      if(m > in->ip->size - in->off)
+        m = in->ip->size - in->off;
+      if(out->type == FD_INODE){
+        w = writei(out->ip, 0, (uint64)(bp->data + in->off % BSIZE), out->off, m);
+        if(w > 0)
+          out->off += w;
+      } else {
+        w = devsw[out->major].write(0, (uint64)(bp->data + in->off % BSIZE), m);
+      }
+      brelse(bp);
+      if(w > 0)
+        in->off += w;
+      if(w != m){
+        err = 1;
+        if(w > 0)
+          i += w;
         break;
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+
+    if(out->type == FD_INODE){
+      iunlock(out->ip);
+      iunlock(in->ip);
+      end_op();
+    } else {
+      iunlock(in->ip);
+    }
+
+    total += i;
+    if(i < n1)
+      break;
   }
 
-  return ret;
+  if(total == 0 && err)
+    return -1;
+  return total;
 }
 
+// Read into the n user buffers in iov, in order, stopping
+// early on a short read.
+int
+filereadv(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, total = 0;
+
+  for(i = 0; i < n; i++){
+    r = fileread(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+    if(r < 0)
+      return total > 0 ? total : -1;
+    total += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+// Write the n user buffers in iov, in order. For a file, if
+// they fit in one log transaction, they get written under a
+// single begin_op()/ilock().
+int
+filewritev(struct file *f, struct iovec *iov, int n)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 len = 0;
+  int i, r, total = 0;
+
+  if(f->writable == 0)
+    return -1;
+  for(i = 0; i < n; i++)
+    len += iov[i].iov_len;
+
+  if(f->type == FD_INODE && len <= max){
+    begin_op();
+    ilock(f->ip);
+    for(i = 0; i < n; i++){
+      r = writei(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len);
+      if(r > 0){
+        f->off += r;
+        total += r;
+      }
+      if(r != iov[i].iov_len)
+        break;
+    }
+    iunlock(f->ip);
+    end_op();
+    return i == n || total > 0 ? total : -1;
+  }
+
+  for(i = 0; i < n; i++){
+    r = filewrite(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+    if(r < 0)
+      return total > 0 ? total : -1;
+    total += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+// Read up to n bytes at offset off of file f to user address
+// addr, leaving f->off alone.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Write n bytes at user address addr to file f at offset off,
+// leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f->ip, 1, addr, &off, n);
+}
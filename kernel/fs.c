@@ -15,11 +15,13 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "lockstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -166,9 +168,12 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries. The table is a list of the inodes with ip->ref > 0;
+// iget() allocates an entry from a slab cache when an inode is
+// first used, and iput() frees it when the last reference goes.
+// Since ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold itable.lock while using ip->ref, ip->dev,
+// ip->inum, or the list links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -176,18 +181,21 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kcache *cache;
+  struct lockstat *lockstat; // for the inodes' sleep locks
+
+  // Linked list of the inodes in use, through prev/next.
+  struct inode head;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kcachecreate("inode", sizeof(struct inode));
+  itable.lockstat = lockregister("inode", LOCK_SLEEP);
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -195,23 +203,30 @@ static struct inode* iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
-// or NULL if there is no free inode.
+// or NULL if there is no free inode or no memory for one.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      // get the in-memory inode first, so that running out
+      // of memory doesn't leave the disk inode allocated.
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -244,34 +259,38 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if out of memory.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.head.next; ip != &itable.head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate an inode entry.
+  if((ip = kcachealloc(itable.cache)) == 0){
+    release(&itable.lock);
+    return 0;
+  }
 
-  ip = empty;
+  initsleeplockstat(&ip->lock, "inode", itable.lockstat);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = itable.head.next;
+  ip->prev = &itable.head;
+  itable.head.next->prev = ip;
+  itable.head.next = ip;
   release(&itable.lock);
 
   return ip;
@@ -328,8 +347,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,8 +377,14 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&itable.lock);
+    return;
+  }
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
   release(&itable.lock);
+  kcachefree(itable.cache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -473,6 +498,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -518,6 +544,21 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Return the locked buffer holding byte off of ip, for callers
+// that want to use file data in place (filecopy()).
+// Caller must hold ip->lock, and off must be < ip->size.
+struct buf*
+iblock(struct inode *ip, uint off)
+{
+  uint addr;
+
+  if(off >= ip->size)
+    return 0;
+  if((addr = bmap(ip, off/BSIZE)) == 0)
+    return 0;
+  return bread(ip->dev, addr);
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -546,6 +587,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    if(ip->type == T_FILE)
+      pcupdate(ip, off, (char*)bp->data + (off % BSIZE), m, user_src ? 0 : src);
     log_write(bp);
     brelse(bp);
   }
@@ -571,6 +614,7 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Returns 0 if not found, or if out of memory.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -602,23 +646,25 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  int off, empty;
   struct dirent de;
-  struct inode *ip;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
-    return -1;
-  }
-
-  // Look for an empty dirent.
+  // Check that name is not present, and look for an empty
+  // dirent. Not with dirlookup(), which can't tell a missing
+  // name from running out of memory for its inode.
+  empty = -1;
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
-    if(de.inum == 0)
-      break;
+    if(de.inum == 0){
+      if(empty < 0)
+        empty = off;
+    } else if(namecmp(name, de.name) == 0){
+      return -1;
+    }
   }
+  if(empty >= 0)
+    off = empty;
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
@@ -675,11 +721,19 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct proc *p;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // threads share the cwd, so hold fdlock against chdir().
+    p = myproc()->leader;
+    acquire(&p->fdlock);
+    ip = idup(p->cwd);
+    release(&p->fdlock);
+  }
+  if(ip == 0)
+    return 0;
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -0,0 +1,3 @@
+// futex() operations.
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
@@ -1,12 +1,30 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and with
+// kallocorder() blocks of 2^order physically contiguous pages.
+//
+// Free memory is kept by a buddy allocator: a free block of 2^k
+// pages is aligned to its size and sits on free list k.
+// kallocorder(k) takes a block from the smallest list that has
+// one, splitting it in halves down to order k. kfree() puts a
+// page back and merges it with its buddy, the other half of the
+// block it was split from, for as long as the buddy is free too.
+//
+// Each page has a reference count, so that a page can be mapped
+// by several processes (shared memory): kalloc() returns a page
+// with one reference, krefinc() adds one, and kfree() drops one,
+// freeing the page when none are left. kallocorder() gives each
+// page of a block a reference of its own, so the pages of a block
+// are freed one at a time, and merge back as they go.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "kmemstat.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
@@ -14,19 +32,31 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// A free block, linked into its order's list through its first
+// page.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDX2PA(i) ((struct run*)(KERNBASE + (uint64)(i) * PGSIZE))
+#define NPAGES PA2IDX(PHYSTOP)
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[KMAXORDER+1];  // list heads, circular
+  int ref[NPAGES];
+  char order[NPAGES];    // k+1 if the page starts a free block of order k
+  struct kmemstat st;
 } kmem;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initticketlock(&kmem.lock, "kmem");
+  for(int k = 0; k <= KMAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,61 +65,282 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2IDX(p)] = 1;
+    kmem.st.npages++;
     kfree(p);
+  }
+}
+
+// Caller must hold kmem.lock.
+static void
+pushblock(struct run *r, int k)
+{
+  r->next = kmem.free[k].next;
+  r->prev = &kmem.free[k];
+  r->next->prev = r;
+  kmem.free[k].next = r;
+  kmem.order[PA2IDX(r)] = k + 1;
+  kmem.st.nfree[k]++;
+}
+
+// Caller must hold kmem.lock.
+static void
+unlinkblock(struct run *r, int k)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.order[PA2IDX(r)] = 0;
+  kmem.st.nfree[k]--;
+}
+
+// Free the block of 2^k pages starting at page i, merging it
+// with its buddy for as long as the buddy is free.
+// Caller must hold kmem.lock.
+static void
+freeblock(uint64 i, int k)
+{
+  uint64 b;
+
+  for(; k < KMAXORDER; k++){
+    b = i ^ (1L << k);
+    if(b + (1L << k) > NPAGES || kmem.order[b] != k + 1)
+      break;
+    unlinkblock(IDX2PA(b), k);
+    kmem.st.nmerge++;
+    i &= ~(1L << k);
+  }
+  pushblock(IDX2PA(i), k);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Take a block of 2^k pages off the free lists, splitting a
+// larger block if there is no block of order k.
+// Caller must hold kmem.lock. Returns 0 if there is none.
+static struct run*
+allocblock(int k)
+{
+  struct run *r;
+  int j;
+
+  for(j = k; j <= KMAXORDER && kmem.free[j].next == &kmem.free[j]; j++)
+    ;
+  if(j > KMAXORDER){
+    kmem.st.nfail++;
+    return 0;
+  }
+  r = kmem.free[j].next;
+  unlinkblock(r, j);
+  // give back the upper half at each step down.
+  while(j > k){
+    j--;
+    pushblock((struct run*)((char*)r + ((uint64)PGSIZE << j)), j);
+    kmem.st.nsplit++;
+  }
+  for(j = 0; j < (1 << k); j++)
+    kmem.ref[PA2IDX(r) + j] = 1;
+  kmem.st.nalloc[k]++;
+  return r;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference is dropped.
 void
 kfree(void *pa)
 {
-  struct run *r;
-
-  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
-    
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("kfree: ref");
+  if(kmem.ref[PA2IDX(pa)] > 1){
+    kmem.ref[PA2IDX(pa)]--;
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
 
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
-  r = (struct run*)pa;
-
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  kmem.ref[PA2IDX(pa)] = 0;
+  freeblock(PA2IDX(pa), 0);
   release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Return the amount of free memory, in KiB.
 uint64
 freemem(void)
 {
+    uint64 pages = 0;
+
     acquire(&kmem.lock);
-    struct run *r = kmem.freelist;
-    int pages = 0;
-    while (r) {
-        pages++;
-        r = r->next;
-    }
+    for(int k = 0; k <= KMAXORDER; k++)
+        pages += kmem.st.nfree[k] << k;
     release(&kmem.lock);
-    return (uint64) pages * (PGSIZE / 1024);
+    return pages * (PGSIZE / 1024);
 }
 
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
 void*
 kalloc(void)
 {
     struct run *r;
 
     acquire(&kmem.lock);
-    r = kmem.freelist;
-    if(r) {kmem.freelist = r->next;}
+    r = allocblock(0);
     release(&kmem.lock);
 
     if(r) {memset((char*)r, 5, PGSIZE);} // fill with junk
-    return (void*)r;               
+    return (void*)r;
 }
+
+// Allocate 2^order physically contiguous pages, aligned to their
+// size, each with a reference of its own. The contents are junk.
+// Returns 0 if there is no free block that big.
+void*
+kallocorder(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > KMAXORDER)
+    return 0;
+  acquire(&kmem.lock);
+  r = allocblock(order);
+  release(&kmem.lock);
+  return (void*)r;
+}
+
+// Allocate up to n pages at once, into pa[0..n), taking the lock
+// once rather than n times. The pages are not filled with junk,
+// since the caller is about to clear them. Returns how many it
+// got, fewer than n only if memory ran out.
+int
+kallocn(void **pa, int n)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n && (r = allocblock(0)) != 0; i++)
+    pa[i] = r;
+  release(&kmem.lock);
+  return i;
+}
+
+// Allocate 2MB of contiguous physical memory, 2MB-aligned, for
+// a megapage. Returns 0 if there is no free block that big.
+void*
+kallocmega(void)
+{
+  return kallocorder(MEGAORDER);
+}
+
+// Add a reference to the page at pa, which must be allocated.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2IDX(pa)] < 1)
+    panic("krefinc: free page");
+  kmem.ref[PA2IDX(pa)]++;
+  release(&kmem.lock);
+}
+
+// Copy the allocator's statistics to user address addr.
+int
+kmemstat(uint64 addr)
+{
+  struct kmemstat st;
+
+  acquire(&kmem.lock);
+  st = kmem.st;
+  release(&kmem.lock);
+  return copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st));
+}
+
+#ifdef KMEMSTRESS
+
+#define NSTRESS 32
+
+// Tag word for page pa of a block held in stress slot i.
+#define STRESSTAG(pa, i) ((uint64)(pa) ^ ((uint64)(i) + 1) << 48)
+
+// Check the tags of the block in stress slot i, and free it a
+// page at a time, in an order that depends on rnd, so that its
+// pages merge back in different orders. Returns 0, or -1 if a
+// tag was overwritten.
+static int
+stressfree(char *pa, int order, int i, uint rnd)
+{
+  int j, n = 1 << order, err = 0;
+  char *p;
+
+  for(j = 0; j < n; j++){
+    p = pa + (uint64)PGSIZE * (rnd & 1 ? n - 1 - j : j);
+    if(*(uint64*)p != STRESSTAG(p, i))
+      err = -1;
+    kfree(p);
+  }
+  return err;
+}
+
+// Stress the allocator for n rounds: each round allocates a block
+// of a random order up to KSTRESSORDER into a random slot, or
+// frees the block already there. Each page of a live block holds
+// a tag naming its slot, so a page handed out twice, or freed
+// while in use, is caught. Returns 0, or -1 if a tag was wrong.
+int
+kmemstress(int n, int seed)
+{
+  struct { char *pa; int order; } live[NSTRESS];
+  uint rnd = seed;
+  int r, i, j, order, err = 0;
+  char *pa;
+
+  memset(live, 0, sizeof(live));
+  for(r = 0; r < n; r++){
+    if((r % 256) == 0 && killed(myproc()))
+      break;
+    rnd = rnd * 1103515245 + 12345;
+    i = (rnd >> 8) % NSTRESS;
+    if(live[i].pa){
+      if(stressfree(live[i].pa, live[i].order, i, rnd >> 20) < 0)
+        err = -1;
+      live[i].pa = 0;
+      continue;
+    }
+    order = (rnd >> 16) % (KSTRESSORDER + 1);
+    if((pa = kallocorder(order)) == 0)
+      continue;
+    for(j = 0; j < (1 << order); j++)
+      *(uint64*)(pa + (uint64)PGSIZE * j) = STRESSTAG(pa + (uint64)PGSIZE * j, i);
+    live[i].pa = pa;
+    live[i].order = order;
+  }
+  for(i = 0; i < NSTRESS; i++)
+    if(live[i].pa && stressfree(live[i].pa, live[i].order, i, i) < 0)
+      err = -1;
+  return err;
+}
+
+#else
+
+// kmemstress() is only in kernels built with KMEMSTRESS (see the
+// Makefile), since it lets any process hold blocks of up to
+// 2^KSTRESSORDER pages for as long as it likes.
+int
+kmemstress(int n, int seed)
+{
+  return -1;
+}
+
+#endif
@@ -0,0 +1,16 @@
+// Physical memory allocator statistics, read by kmemstat().
+// Both the kernel and user programs use this header file.
+// Free memory is kept in blocks of 2^k pages, k <= KMAXORDER.
+
+#define KMAXORDER 10     // largest block: 2^10 pages, 4MB
+#define MEGAORDER 9      // a 2MB megapage
+#define KSTRESSORDER 6   // largest block kmemstress() asks for
+
+struct kmemstat {
+  uint64 npages;                // pages the allocator manages
+  uint64 nfree[KMAXORDER+1];    // free blocks of each order
+  uint64 nalloc[KMAXORDER+1];   // allocations of each order
+  uint64 nsplit;                // blocks split in half to allocate
+  uint64 nmerge;                // blocks merged with their buddy on free
+  uint64 nfail;                 // allocations with no block big enough
+};
@@ -0,0 +1,155 @@
+// Lock contention statistics.
+//
+// initlock() and initsleeplock() register each lock under its
+// name; locks with the same name and kind share a struct
+// lockstat. The locks in objects from a kcache are registered
+// once per cache instead, and initialized with initlockstat()
+// or initsleeplockstat(). acquire()/release() and
+// acquiresleep()/releasesleep() then update the shared counters
+// with atomic adds, since several locks of one name can be held
+// on different CPUs at once. lockstat() copies the table out to
+// user space.
+//
+// lockbench() hammers one of two kernel locks, a test-and-set
+// lock and a ticket lock, so user space can compare them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "lockstat.h"
+#include "defs.h"
+
+static struct lockstat stats[NLOCKSTAT];
+static int nstats;
+
+// Protects stats[] names and nstats. Deliberately never passed
+// to initlock(), so that acquiring it doesn't record statistics
+// (or recurse into lockregister()).
+static struct spinlock statlock;
+
+// Find or allocate the entry for name and kind.
+// Returns 0 if the table is full; such locks go untracked.
+struct lockstat*
+lockregister(char *name, int kind)
+{
+  struct lockstat *s;
+
+  acquire(&statlock);
+  for(s = stats; s < &stats[nstats]; s++){
+    if(s->kind == kind && strncmp(s->name, name, LOCKNAME-1) == 0){
+      s->nlocks++;
+      release(&statlock);
+      return s;
+    }
+  }
+  if(nstats == NLOCKSTAT){
+    release(&statlock);
+    return 0;
+  }
+  s = &stats[nstats++];
+  safestrcpy(s->name, name, LOCKNAME);
+  s->kind = kind;
+  s->nlocks = 1;
+  release(&statlock);
+  return s;
+}
+
+// Record a contended acquisition that started waiting at start.
+void
+lockcontended(struct lockstat *s, uint64 start)
+{
+  if(s == 0)
+    return;
+  __atomic_fetch_add(&s->ncontended, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&s->waittime, r_time() - start, __ATOMIC_RELAXED);
+}
+
+// Record a hold of t cycles, keeping the maximum.
+void
+lockhold(struct lockstat *s, uint64 t)
+{
+  uint64 old = __atomic_load_n(&s->maxhold, __ATOMIC_RELAXED);
+
+  while(t > old &&
+        !__atomic_compare_exchange_n(&s->maxhold, &old, t, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Copy up to n entries to the user array at addr.
+// Returns the number copied, or -1.
+int
+lockstat(uint64 addr, int n)
+{
+  struct lockstat s;
+  int i;
+
+  if(n < 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    acquire(&statlock);
+    if(i >= nstats){
+      release(&statlock);
+      break;
+    }
+    s = stats[i];
+    release(&statlock);
+    if(copyout(myproc()->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return i;
+}
+
+static struct spinlock benchlock[2];
+static uint64 benchcount;
+
+void
+lockbenchinit(void)
+{
+  initlock(&benchlock[LOCKBENCH_TAS], "bench tas");
+  initticketlock(&benchlock[LOCKBENCH_TICKET], "bench ticket");
+}
+
+// Acquire and release the benchmark lock of the given kind n
+// times, and copy a struct lockbench describing how long each
+// acquire waited to addr.
+int
+lockbench(int kind, int n, uint64 addr)
+{
+  struct lockbench r;
+  struct spinlock *lk;
+  uint64 t0, start, wait;
+  int i, b;
+
+  if((kind != LOCKBENCH_TAS && kind != LOCKBENCH_TICKET) || n < 0)
+    return -1;
+  lk = &benchlock[kind];
+  memset(&r, 0, sizeof(r));
+
+  t0 = r_time();
+  for(i = 0; i < n; i++){
+    if((i % 1024) == 0 && killed(myproc()))
+      return -1;
+    start = r_time();
+    acquire(lk);
+    wait = r_time() - start;
+    benchcount++;
+    release(lk);
+
+    for(b = 0; b < LOCKBENCH_NHIST-1 && (wait >> b) != 0; b++)
+      ;
+    r.hist[b]++;
+    if(wait > r.maxwait)
+      r.maxwait = wait;
+  }
+  r.elapsed = r_time() - t0;
+  r.nacquire = n;
+
+  if(copyout(myproc()->pagetable, addr, (char*)&r, sizeof(r)) < 0)
+    return -1;
+  return 0;
+}
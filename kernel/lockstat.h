@@ -0,0 +1,34 @@
+// Lock contention statistics, read by lockstat().
+// Both the kernel and user programs use this header file.
+// Locks are grouped by name: every lock initialized with the
+// same name (e.g. all the "proc" locks) shares one entry.
+// Times are in time CSR cycles (TIMEBASE per second).
+
+#define LOCKNAME 16
+
+struct lockstat {
+  char name[LOCKNAME];
+  int kind;             // LOCK_SPIN or LOCK_SLEEP
+  int nlocks;           // initlock() calls with this name; a
+                        // kcache's objects' locks count once
+  uint64 nacquire;      // acquisitions
+  uint64 ncontended;    // acquisitions that had to spin or sleep
+  uint64 waittime;      // total time spent spinning or sleeping
+  uint64 maxhold;       // longest time the lock was held
+};
+
+#define LOCK_SPIN   0
+#define LOCK_SLEEP  1
+
+// lockbench() results: acquire latency of a kernel lock of the
+// given kind, as a histogram of log2(time CSR cycles).
+#define LOCKBENCH_TAS     0
+#define LOCKBENCH_TICKET  1
+#define LOCKBENCH_NHIST   24
+
+struct lockbench {
+  uint64 nacquire;
+  uint64 elapsed;              // time for the whole run
+  uint64 maxwait;              // slowest acquire
+  uint64 hist[LOCKBENCH_NHIST]; // hist[i]: acquires that waited [2^(i-1), 2^i) cycles
+};
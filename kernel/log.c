@@ -56,7 +56,7 @@ initlog(int dev, struct superblock *sb)
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
-  initlock(&log.lock, "log");
+  initticketlock(&log.lock, "log");
   log.start = sb->logstart;
   log.dev = dev;
   recover_from_log();
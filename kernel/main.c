@@ -19,14 +19,22 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    vdatainit();     // page of kernel data shared with user space
     procinit();      // process table
     trapinit();      // trap vectors
+    timerqinit();    // per-CPU timer queues
+    profinit();      // sampling profiler
+    lockbenchinit(); // locks for the lockbench() microbenchmark
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
+    slabinit();      // caches of small kernel objects
     binit();         // buffer cache
+    pcinit();        // page cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipes
+    shminit();       // shared memory segments
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -17,6 +17,12 @@
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
+// core local interruptor (CLINT). writing 1 to a hart's msip
+// word raises a machine-mode software interrupt on that hart,
+// which mswivec in kernelvec.S turns into a supervisor one.
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
+
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
 #define UART0_IRQ 10
@@ -57,6 +63,14 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed regions, allocated downward from MMAPBASE
+//   THREADFRAME(1..NTHREAD-1) (trapframes of a process's threads)
+//   VDATA (kernel data shared by all processes, read-only)
+//   USYSCALL (per-process kernel data, read-only)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define VDATA (USYSCALL - PGSIZE)
+#define THREADFRAME(t) ((t) == 0 ? TRAPFRAME : VDATA - (t)*PGSIZE)
+#define MMAPBASE (VDATA - NTHREAD*PGSIZE)
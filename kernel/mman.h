@@ -0,0 +1,7 @@
+// mmap() protection bits and flags.
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_ANON    0x1   // not backed by a file; zero-filled
+#define MAP_PRIVATE 0x2   // changes are private to the process
+#define MAP_SHARED  0x4   // changes are written back to the file
@@ -0,0 +1,591 @@
+// Memory-mapped regions.
+//
+// A process's mappings live in p->mmaps[0..p->nmmaps), sorted
+// by address and never overlapping. mmap() puts a new mapping
+// in the highest gap below p->mmap_base that fits it, so
+// p->mmap_next, the lowest mapped address, only moves down as
+// far as it must; sbrk() may not grow the heap past it.
+//
+// mmap() allocates no memory: vmfault() calls mmapfault() the
+// first time each page is touched. A read of an anonymous page
+// maps the shared zero page until the page is written. munmap()
+// may unmap any part of a region, trimming or splitting it.
+//
+// A file mapping holds a reference to the file, and maps pages
+// from the page cache (pagecache.c). Pages of a MAP_SHARED
+// mapping are mapped read-only until first written, so that
+// mmapfault() can mark them dirty; munmap(), msync() and exit
+// write dirty pages back. A MAP_PRIVATE mapping maps cache pages
+// read-only, and copies a page the first time it is written.
+//
+// A shared memory segment (shm.c) is mapped like a file, except
+// that its pages are mapped writable at once and need no write
+// back. MAP_SHARED|MAP_ANON maps a new unnamed segment.
+//
+// Threads share their process's mappings, which live in the
+// leader's proc. The regions and PTEs change only under the
+// leader's vmlock; mmap(), munmap() and msync(), which must
+// sleep with the regions held still, also set mmapbusy.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "mman.h"
+#include "defs.h"
+
+// Index of the region containing va, or -1.
+static int
+findregion(struct proc *p, uint64 va)
+{
+  int lo = 0, hi = p->nmmaps - 1, mid;
+  struct mmap_region *r;
+
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    r = &p->mmaps[mid];
+    if(va < r->addr)
+      hi = mid - 1;
+    else if(va >= r->addr + r->length)
+      lo = mid + 1;
+    else
+      return mid;
+  }
+  return -1;
+}
+
+// Is [va, va+len) clear of the heap and of other mappings?
+static int
+rangefree(struct proc *p, uint64 va, uint64 len)
+{
+  struct mmap_region *r;
+
+  if(va < PGROUNDUP(p->sz) || va + len < va || va + len > p->mmap_base)
+    return 0;
+  for(r = p->mmaps; r < &p->mmaps[p->nmmaps]; r++)
+    if(va < r->addr + r->length && r->addr < va + len)
+      return 0;
+  return 1;
+}
+
+// Start of the highest free range of len bytes, or 0.
+static uint64
+placeregion(struct proc *p, uint64 len)
+{
+  uint64 top = p->mmap_base;
+  struct mmap_region *r;
+  int i;
+
+  for(i = p->nmmaps - 1; i >= 0; i--){
+    r = &p->mmaps[i];
+    if(top - (r->addr + r->length) >= len)
+      break;
+    top = r->addr;
+  }
+  if(top < len || top - len < PGROUNDUP(p->sz))
+    return 0;
+  return top - len;
+}
+
+static int
+insertregion(struct proc *p, struct mmap_region *nr)
+{
+  int i;
+
+  if(p->nmmaps == MAX_MMAPS)
+    return -1;
+  for(i = p->nmmaps; i > 0 && p->mmaps[i-1].addr > nr->addr; i--)
+    p->mmaps[i] = p->mmaps[i-1];
+  p->mmaps[i] = *nr;
+  p->nmmaps++;
+  p->mmap_next = p->mmaps[0].addr;
+  return 0;
+}
+
+// Do r's pages come from the page cache?
+static int
+cached(struct mmap_region *r)
+{
+  return r->f != 0 && r->f->type == FD_INODE;
+}
+
+// Remove the PTEs for [va, va+len) in r, dropping the
+// references to their pages.
+static void
+unmaprange(struct proc *p, struct mmap_region *r, uint64 va, uint64 len)
+{
+  pte_t *pte;
+  uint64 a, pa;
+
+  if(!cached(r)){
+    uvmunmap(p->pagetable, va, len / PGSIZE, 1);
+    return;
+  }
+  // as uvmunmap() does, clear PTE_V and drop the pages only once
+  // no other hart's TLB maps them.
+  for(a = va; a < va + len; a += PGSIZE)
+    if((pte = walk(p->pagetable, a, 0)) != 0)
+      *pte &= ~PTE_V;
+  tlbshootdown(p->pagetable);
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(!pcput(pa))
+      kfree((void*)pa);
+    *pte = 0;
+  }
+}
+
+// Write back the dirty pages of [va, va+len) in r, if it is a
+// shared file mapping. Returns 0, or -1.
+static int
+syncrange(struct mmap_region *r, uint64 va, uint64 len)
+{
+  if(!cached(r) || (r->flags & MAP_SHARED) == 0)
+    return 0;
+  return pcsync(r->f->ip, r->offset + (va - r->addr), len);
+}
+
+// Mark p's regions busy, waiting for another thread's mmap(),
+// munmap() or msync() to finish. Caller must hold p->vmlock.
+static void
+mmlock(struct proc *p)
+{
+  while(p->mmapbusy)
+    sleep(&p->mmapbusy, &p->vmlock);
+  p->mmapbusy = 1;
+}
+
+// Clear mmapbusy and release p->vmlock, which the caller holds.
+// The wakeup comes after the release, since wakeup() takes every
+// p->lock and kfork() holds one while it takes vmlock.
+static void
+mmunlock(struct proc *p)
+{
+  p->mmapbusy = 0;
+  release(&p->vmlock);
+  wakeup(&p->mmapbusy);
+}
+
+static void
+removeregion(struct proc *p, int i)
+{
+  for(; i < p->nmmaps - 1; i++)
+    p->mmaps[i] = p->mmaps[i+1];
+  p->nmmaps--;
+  p->mmap_next = p->nmmaps > 0 ? p->mmaps[0].addr : p->mmap_base;
+}
+
+// Map length bytes, rounded up to whole pages, of zeroes or of
+// the file or segment open on fd from offset on. addr is a hint,
+// used if it is page-aligned and the range is free.
+// Returns the address of the mapping, or -1.
+uint64
+kmmap(uint64 addr, int length, int prot, int flags, int fd, int offset)
+{
+  struct file *f = 0;
+  uint64 len;
+
+  if(length <= 0 || (prot & ~(PROT_READ|PROT_WRITE)) != 0)
+    return -1;
+  if((flags & MAP_SHARED) && (flags & MAP_PRIVATE))
+    return -1;
+  if((flags & MAP_ANON) == 0){
+    if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0)
+      return -1;
+    if(offset < 0 || offset % PGSIZE != 0)
+      return -1;
+    // the mapping takes over fdfile()'s reference.
+    if(fdfile(fd, &f) < 0)
+      return -1;
+    if(!f->readable)
+      goto bad;
+    if(f->type == FD_SHM){
+      if((flags & MAP_SHARED) == 0)
+        goto bad;
+    } else if(f->type != FD_INODE || f->ip->type != T_FILE){
+      goto bad;
+    }
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      goto bad;
+  }
+  len = PGROUNDUP((uint64)length);
+
+  if(f == 0 && (flags & MAP_SHARED)){
+    if(len > SHMPAGES*PGSIZE || (f = shmopen("", len, O_RDWR)) == 0)
+      return -1;
+    offset = 0;
+  }
+  return mmapfile(addr, len, prot, flags, f, offset);
+
+ bad:
+  fileclose(f);
+  return -1;
+}
+
+// Map len bytes, a multiple of PGSIZE, of f from offset on, or
+// of zeroes if f is 0, in the calling process, as kmmap() does
+// once it has checked its arguments. The mapping takes over the
+// caller's reference to f, and closes it on failure.
+// Returns the address of the mapping, or -1.
+uint64
+mmapfile(uint64 addr, uint64 len, int prot, int flags, struct file *f, int offset)
+{
+  struct proc *p = myproc()->leader;
+  struct mmap_region r;
+
+  acquire(&p->vmlock);
+  mmlock(p);
+  if(addr == 0 || addr % PGSIZE != 0 || !rangefree(p, addr, len))
+    addr = placeregion(p, len);
+  r.addr = addr;
+  r.length = len;
+  r.prot = prot;
+  r.flags = flags;
+  r.f = f;
+  r.offset = f ? offset : 0;
+  if(addr == 0 || insertregion(p, &r) < 0){
+    mmunlock(p);
+    if(f)
+      fileclose(f);
+    return -1;
+  }
+  mmunlock(p);
+  return addr;
+}
+
+// Unmap the pages in [addr, addr+length), which may cover any
+// part of any number of regions, writing back shared file
+// pages. Returns 0, or -1.
+uint64
+kmunmap(uint64 addr, int length)
+{
+  struct proc *p = myproc()->leader;
+  struct mmap_region *r, old, tail;
+  uint64 end, rend, s, e;
+  int i;
+
+  if(addr % PGSIZE != 0 || length <= 0)
+    return -1;
+  end = addr + PGROUNDUP((uint64)length);
+  if(end < addr)
+    return -1;
+
+  acquire(&p->vmlock);
+  mmlock(p);
+
+  // punching a hole in a region needs a free slot for its tail.
+  for(r = p->mmaps; r < &p->mmaps[p->nmmaps]; r++){
+    if(r->addr < addr && end < r->addr + r->length && p->nmmaps == MAX_MMAPS){
+      mmunlock(p);
+      return -1;
+    }
+  }
+
+  for(i = 0; i < p->nmmaps; i++){
+    r = &p->mmaps[i];
+    rend = r->addr + r->length;
+    if(rend <= addr || r->addr >= end)
+      continue;
+    s = r->addr > addr ? r->addr : addr;
+    e = rend < end ? rend : end;
+    unmaprange(p, r, s, e - s);
+    old = *r;
+    if(s == r->addr && e == rend){
+      removeregion(p, i--);
+      // writing back and closing the file sleep, and mmapbusy
+      // keeps the other regions where they are meanwhile.
+      release(&p->vmlock);
+      syncrange(&old, s, e - s);
+      if(old.f)
+        fileclose(old.f);
+      acquire(&p->vmlock);
+      continue;
+    }
+    if(s == r->addr){
+      r->offset += e - r->addr;
+      r->length = rend - e;
+      r->addr = e;
+    } else if(e == rend){
+      r->length = s - r->addr;
+    } else {
+      tail = *r;
+      tail.addr = e;
+      tail.length = rend - e;
+      tail.offset += e - r->addr;
+      r->length = s - r->addr;
+      insertregion(p, &tail);
+      if(tail.f)
+        filedup(tail.f);
+      i++;
+    }
+    release(&p->vmlock);
+    syncrange(&old, s, e - s);
+    acquire(&p->vmlock);
+  }
+  p->mmap_next = p->nmmaps > 0 ? p->mmaps[0].addr : p->mmap_base;
+  mmunlock(p);
+  return 0;
+}
+
+// A write to the file page pa, mapped read-only at *pte in r:
+// mark it dirty if r is shared, or give the process its own copy.
+// Returns the physical address now mapped, or 0.
+static uint64
+writefault(struct mmap_region *r, pte_t *pte, uint64 pa)
+{
+  uint64 mem;
+
+  if(r->flags & MAP_SHARED){
+    pcdirty(pa);
+    *pte |= PTE_W;
+    return pa;
+  }
+  if((mem = (uint64)kalloc()) == 0)
+    return 0;
+  memmove((void*)mem, (void*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W;
+  pcput(pa);
+  return mem;
+}
+
+// Map the page holding va, if va lies in a mapping that permits
+// the access: a zeroed page for an anonymous mapping, or the
+// file's page from the page cache. Also handles the first write
+// to a file page already mapped read-only. Called by vmfault(),
+// with p the process whose mappings these are.
+// Returns the physical address, or 0.
+uint64
+mmapfault(struct proc *p, uint64 va, int read)
+{
+  struct mmap_region *r;
+  struct file *f;
+  pte_t *pte;
+  uint64 mem, off;
+  int i, perm;
+
+  va = PGROUNDDOWN(va);
+  acquire(&p->vmlock);
+again:
+  if((i = findregion(p, va)) < 0)
+    goto bad;
+  r = &p->mmaps[i];
+  if((r->prot & (read ? PROT_READ|PROT_WRITE : PROT_WRITE)) == 0)
+    goto bad;
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // another thread may have mapped it first.
+    if(read || (*pte & PTE_W)){
+      release(&p->vmlock);
+      return PTE2PA(*pte);
+    }
+    if(r->f == 0)
+      mem = zerocopy(pte);
+    else if(cached(r))
+      mem = writefault(r, pte, PTE2PA(*pte));
+    else
+      mem = 0;
+    release(&p->vmlock);
+    return mem;
+  }
+
+  perm = PTE_U | PTE_R;
+  if(!cached(r) && (r->prot & PROT_WRITE))
+    perm |= PTE_W;
+  off = r->offset + (va - r->addr);
+  if(r->f == 0 && read){
+    mem = zeromap(p->pagetable, va, perm);
+    if(mem)
+      myproc()->ru.nfault++;
+    release(&p->vmlock);
+    return mem;
+  } else if(r->f == 0){
+    if((mem = (uint64)kalloc()) == 0)
+      goto bad;
+    memset((void*)mem, 0, PGSIZE);
+  } else if(r->f->type == FD_SHM){
+    if((mem = shmpage(r->f->shm, off)) == 0)
+      goto bad;
+  } else if(mycpu()->noff > 1){
+    // the caller holds a spinlock, so pcget() won't sleep.
+    if((mem = pcget(r->f->ip, off)) == 0)
+      goto bad;
+  } else {
+    // pcget() may sleep reading the file, so let go of vmlock,
+    // holding on to the file in case munmap() closes it.
+    f = filedup(r->f);
+    release(&p->vmlock);
+    mem = pcget(f->ip, off);
+    acquire(&p->vmlock);
+    if((i = findregion(p, va)) < 0 || p->mmaps[i].f != f ||
+       p->mmaps[i].offset + (va - p->mmaps[i].addr) != off ||
+       ismapped(p->pagetable, va)){
+      // the mapping changed meanwhile; look again.
+      release(&p->vmlock);
+      if(mem)
+        pcput(mem);
+      fileclose(f);
+      acquire(&p->vmlock);
+      goto again;
+    }
+    release(&p->vmlock);
+    fileclose(f);
+    acquire(&p->vmlock);
+    if(mem == 0)
+      goto bad;
+    r = &p->mmaps[i];
+  }
+  if(mappages(p->pagetable, va, PGSIZE, mem, perm) != 0){
+    if(!cached(r) || !pcput(mem))
+      kfree((void*)mem);
+    goto bad;
+  }
+  myproc()->ru.nfault++;
+  if(cached(r) && !read)
+    mem = writefault(r, walk(p->pagetable, va, 0), mem);
+  release(&p->vmlock);
+  return mem;
+
+bad:
+  release(&p->vmlock);
+  return 0;
+}
+
+// Write back the shared file pages in [addr, addr+length).
+// Returns 0, or -1.
+uint64
+kmsync(uint64 addr, int length)
+{
+  struct proc *p = myproc()->leader;
+  struct mmap_region *r;
+  uint64 end, rend, s, e;
+  int err = 0;
+
+  if(addr % PGSIZE != 0 || length <= 0)
+    return -1;
+  end = addr + PGROUNDUP((uint64)length);
+  if(end < addr)
+    return -1;
+  acquire(&p->vmlock);
+  mmlock(p);
+  release(&p->vmlock);
+  for(r = p->mmaps; r < &p->mmaps[p->nmmaps]; r++){
+    rend = r->addr + r->length;
+    if(rend <= addr || r->addr >= end)
+      continue;
+    s = r->addr > addr ? r->addr : addr;
+    e = rend < end ? rend : end;
+    if(syncrange(r, s, e - s) < 0)
+      err = -1;
+  }
+  acquire(&p->vmlock);
+  mmunlock(p);
+  return err;
+}
+
+// Map the page cache and segment pages of mapping r in np too,
+// and copy its private pages. Returns 0, or -1.
+static int
+copyfilepages(struct mmap_region *r, pagetable_t old, pagetable_t new)
+{
+  pte_t *pte;
+  uint64 a, pa;
+  char *mem;
+
+  for(a = r->addr; a < r->addr + r->length; a += PGSIZE){
+    if((pte = walk(old, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(!cached(r) || pcdup(pa)){
+      if(!cached(r))
+        krefinc((void*)pa);
+      if(mappages(new, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0){
+        if(!cached(r) || !pcput(pa))
+          kfree((void*)pa);
+        return -1;
+      }
+      continue;
+    }
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    if(mappages(new, a, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Give child np copies of p's mappings and of the pages in them
+// that p has touched; file pages are shared through the page
+// cache, and segment pages are shared directly. Caller must
+// hold p->vmlock.
+// Returns 0, or -1; freeproc() cleans up.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct mmap_region *r;
+  int i, err;
+
+  np->mmap_base = p->mmap_base;
+  np->mmap_next = p->mmap_next;
+  for(i = 0; i < p->nmmaps; i++){
+    r = &p->mmaps[i];
+    np->mmaps[i] = *r;
+    np->nmmaps = i + 1;
+    if(r->f)
+      err = copyfilepages(r, p->pagetable, np->pagetable);
+    else
+      err = uvmcopyrange(p->pagetable, np->pagetable, r->addr, r->length);
+    if(err < 0)
+      return -1;
+  }
+  // the file references are taken last, so that freeproc(),
+  // which can't sleep in fileclose(), need not drop them.
+  for(i = 0; i < np->nmmaps; i++)
+    if(np->mmaps[i].f)
+      filedup(np->mmaps[i].f);
+  return 0;
+}
+
+// Unmap all of p's mappings, writing back shared file pages and
+// closing the files, for exit and exec, once p has no threads.
+void
+mmapclose(struct proc *p)
+{
+  struct mmap_region *r;
+
+  for(r = p->mmaps; r < &p->mmaps[p->nmmaps]; r++){
+    unmaprange(p, r, r->addr, r->length);
+    if(r->f){
+      syncrange(r, r->addr, r->length);
+      fileclose(r->f);
+    }
+  }
+  p->nmmaps = 0;
+  p->mmap_next = p->mmap_base;
+}
+
+// Unmap whatever mappings p still has, without sleeping, for
+// freeproc(). The file references must already be gone: either
+// mmapclose() dropped them, or mmapcopy() failed before taking
+// them.
+void
+mmapfree(struct proc *p)
+{
+  struct mmap_region *r;
+
+  for(r = p->mmaps; r < &p->mmaps[p->nmmaps]; r++)
+    unmaprange(p, r, r->addr, r->length);
+  p->nmmaps = 0;
+  p->mmap_next = p->mmap_base;
+}
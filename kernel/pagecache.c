@@ -0,0 +1,329 @@
+// Page cache.
+//
+// The page cache holds whole pages of file data for mmap().
+// Every process that maps the same page of a file maps the same
+// physical page, so a MAP_SHARED store is seen by all of them at
+// once, and a MAP_PRIVATE mapping only copies a page when the
+// process first writes it.
+//
+// Interface:
+// * pcget() returns the page holding a file offset, reading it
+//   from the inode if it isn't cached, with its reference count
+//   raised for the caller's PTE.
+// * pcput() drops such a reference; the page stays cached, and
+//   is recycled least-recently-used first, once it is clean.
+// * pcdirty() marks a page written through a shared mapping, and
+//   pcsync() writes dirty pages back to the file. A page stays
+//   dirty while it is mapped (a writable PTE can be written again
+//   at any time), so whoever drops the last mapping syncs again.
+// * writei() calls pcupdate() so that mappings see write()s.
+//   read() does not look in the cache, so it sees a shared
+//   mapping's stores only after msync() or munmap().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+struct cpage {
+  uint dev;
+  uint inum;          // 0 if the page holds no file's data
+  uint off;           // file offset, a multiple of PGSIZE
+  uint64 pa;          // the page, or 0 if none allocated yet
+  int ref;            // PTEs that map pa
+  int dirty;          // written through a shared mapping
+  int loading;        // being read from the file
+  int stale;          // written while loading; read it again
+  int writing;        // being written back to the file
+  struct cpage *prev; // LRU list
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPAGECACHE];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  struct cpage head;
+} pcache;
+
+void
+pcinit(void)
+{
+  struct cpage *c;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(c = pcache.page; c < pcache.page+NPAGECACHE; c++){
+    c->next = pcache.head.next;
+    c->prev = &pcache.head;
+    pcache.head.next->prev = c;
+    pcache.head.next = c;
+  }
+}
+
+// Move c to the front of the LRU list.
+// Caller must hold pcache.lock.
+static void
+touch(struct cpage *c)
+{
+  c->next->prev = c->prev;
+  c->prev->next = c->next;
+  c->next = pcache.head.next;
+  c->prev = &pcache.head;
+  pcache.head.next->prev = c;
+  pcache.head.next = c;
+}
+
+// Caller must hold pcache.lock.
+static struct cpage*
+lookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.head.next; c != &pcache.head; c = c->next)
+    if(c->inum == ip->inum && c->dev == ip->dev && c->off == off)
+      return c;
+  return 0;
+}
+
+// Caller must hold pcache.lock.
+static struct cpage*
+findpa(uint64 pa)
+{
+  struct cpage *c;
+
+  for(c = pcache.head.next; c != &pcache.head; c = c->next)
+    if(c->pa == pa)
+      return c;
+  return 0;
+}
+
+// Return the physical address of the cached page holding byte
+// off of ip, which must be page-aligned and inside the file,
+// with a reference taken for the caller. The caller must hold a
+// reference to ip. Returns 0 if the cache is full of mapped or
+// dirty pages, or on error.
+uint64
+pcget(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  uint64 pa;
+  int locked, n;
+
+  acquire(&pcache.lock);
+  for(;;){
+    if((c = lookup(ip, off)) == 0)
+      break;
+    if(!c->loading){
+      c->ref++;
+      touch(c);
+      release(&pcache.lock);
+      return c->pa;
+    }
+    // can't sleep if the caller holds a spinlock
+    // (copyout() from piperead(), say).
+    if(mycpu()->noff > 1){
+      release(&pcache.lock);
+      return 0;
+    }
+    sleep(c, &pcache.lock);
+  }
+
+  // Not cached; reading it will sleep, as above.
+  if(mycpu()->noff > 1){
+    release(&pcache.lock);
+    return 0;
+  }
+
+  // Recycle the least recently used clean, unmapped page.
+  for(c = pcache.head.prev; c != &pcache.head; c = c->prev)
+    if(c->ref == 0 && !c->dirty && !c->loading && !c->writing)
+      break;
+  if(c == &pcache.head || (c->pa == 0 && (c->pa = (uint64)kalloc()) == 0)){
+    release(&pcache.lock);
+    return 0;
+  }
+  c->dev = ip->dev;
+  c->inum = ip->inum;
+  c->off = off;
+  c->ref = 1;
+  c->loading = 1;
+  touch(c);
+  pa = c->pa;
+
+  // the caller may already hold ip->lock: read() into a
+  // private mapping of the file being read. A write() that
+  // lands after readi() but before loading is cleared marks
+  // the page stale, and it is read again.
+  locked = holdingsleep(&ip->lock);
+  do {
+    c->stale = 0;
+    release(&pcache.lock);
+    memset((void*)pa, 0, PGSIZE);
+    if(!locked)
+      ilock(ip);
+    n = off < ip->size ? readi(ip, 0, pa, off, PGSIZE) : -1;
+    if(!locked)
+      iunlock(ip);
+    acquire(&pcache.lock);
+  } while(c->stale && n > 0);
+  c->loading = 0;
+  if(n <= 0){
+    c->inum = 0;
+    c->ref = 0;
+    pa = 0;
+  }
+  wakeup(c);
+  release(&pcache.lock);
+  return pa;
+}
+
+// Drop a reference taken by pcget() or pcdup().
+// Returns 0 if pa isn't a page cache page.
+int
+pcput(uint64 pa)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = findpa(pa)) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  if(c->ref < 1)
+    panic("pcput");
+  c->ref--;
+  release(&pcache.lock);
+  return 1;
+}
+
+// Take another reference to pa, for fork().
+// Returns 0 if pa isn't a page cache page.
+int
+pcdup(uint64 pa)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = findpa(pa)) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  c->ref++;
+  release(&pcache.lock);
+  return 1;
+}
+
+// Note that pa is about to be written through a shared mapping.
+void
+pcdirty(uint64 pa)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = findpa(pa)) != 0 && c->inum != 0)
+    c->dirty = 1;
+  release(&pcache.lock);
+}
+
+// Write the dirty cached pages of ip in [off, off+len) back to
+// the file. A page that is no longer mapped is marked clean.
+// Returns 0, or -1 if a write failed.
+int
+pcsync(struct inode *ip, uint off, uint len)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct cpage *c;
+  uint o, end, i, n, n1;
+  int r, err = 0;
+
+  end = off + len;
+  if(end < off || end > MAXFILE*BSIZE)
+    end = MAXFILE*BSIZE;
+  for(o = off; o < end; o += PGSIZE){
+    acquire(&pcache.lock);
+    c = lookup(ip, o);
+    if(c == 0 || !c->dirty || c->loading || c->writing){
+      release(&pcache.lock);
+      continue;
+    }
+    c->writing = 1;
+    release(&pcache.lock);
+
+    // write a few blocks at a time, as filewrite() does,
+    // to avoid exceeding the maximum log transaction size.
+    ilock(ip);
+    n = o < ip->size ? ip->size - o : 0;
+    iunlock(ip);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    for(i = 0; i < n; i += r){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(ip);
+      r = writei(ip, 0, c->pa + i, o + i, n1);
+      iunlock(ip);
+      end_op();
+      if(r != n1){
+        err = -1;
+        break;
+      }
+    }
+
+    acquire(&pcache.lock);
+    c->writing = 0;
+    if(c->ref == 0 && i >= n)
+      c->dirty = 0;
+    release(&pcache.lock);
+  }
+  return err;
+}
+
+// Copy n bytes written to byte off of ip into the cached page
+// holding them, if there is one. The bytes must lie in one page.
+// Called by writei(); from is the kernel address the writer
+// copied them from, or 0, so that pcsync()'s own write-back of
+// the page is recognized and skipped.
+void
+pcupdate(struct inode *ip, uint off, char *src, uint n, uint64 from)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  c = lookup(ip, PGROUNDDOWN(off));
+  if(c && c->loading)
+    c->stale = 1;
+  else if(c && from != c->pa + off % PGSIZE)
+    memmove((char*)c->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Forget the cached pages of ip, whose contents are being
+// discarded. Pages still mapped stay mapped, but are no longer
+// found by pcget() or written back.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.head.next; c != &pcache.head; c = c->next){
+    if(c->inum == ip->inum && c->dev == ip->dev && !c->loading){
+      c->inum = 0;
+      c->dirty = 0;
+    }
+  }
+  release(&pcache.lock);
+}
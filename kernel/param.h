@@ -1,15 +1,22 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NTHREAD      16  // maximum threads per process, including the first
 #define NDEV         10  // maximum major device number
+#define NLOCKSTAT    64  // maximum number of distinct lock names tracked
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // disk blocks to keep cached
+#define NPAGECACHE   256  // pages in the mmap() page cache
+#define NSHM         16  // maximum number of shared memory segments
+#define SHMPAGES     64  // maximum pages in a shared memory segment
 #define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
+#define FAULTAROUND  16    // most lazy heap pages one page fault maps
+#define TIMEBASE     10000000  // time CSR frequency (Hz) on qemu virt
+#define TICKCYCLES   (TIMEBASE/10) // time CSR cycles per clock tick
+#define QUANTUM      (TIMEBASE/10) // default scheduling time slice
 
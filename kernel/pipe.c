@@ -3,22 +3,62 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "lockstat.h"
 
-#define PIPESIZE 512
+// A pipe's data lives in a ring of whole pages, separate from
+// struct pipe, so that pipewrite() and piperead() can move a
+// contiguous span of the ring with one copyin()/copyout()
+// instead of a byte at a time. The ring size is always a power
+// of two so that nread and nwrite can wrap around freely.
+#define PIPESIZE     PGSIZE        // default capacity
+#define PIPEMAXPAGES 16            // capacity limit, in pages
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *pages[PIPEMAXPAGES];  // ring buffer, size bytes long
+  uint size;      // capacity in bytes, a power of two
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int wbusy;      // pipefill() is filling the space after nwrite
+  int rbusy;      // pipedrain() is draining the data after nread
 };
 
+static struct kcache *pipecache;
+static struct lockstat *pipestat;  // for the pipes' locks
+
+void
+pipeinit(void)
+{
+  pipecache = kcachecreate("pipe", sizeof(struct pipe));
+  pipestat = lockregister("pipe", LOCK_SPIN);
+}
+
+// Address of byte n of the ring, and how many bytes from there
+// on are contiguous in memory.
+static char*
+pipebyte(struct pipe *pi, uint n, uint *contig)
+{
+  uint off = n & (pi->size - 1);
+
+  *contig = PGSIZE - off % PGSIZE;
+  return pi->pages[off / PGSIZE] + off % PGSIZE;
+}
+
+static void
+pipefreepages(char **pages, int npages)
+{
+  for(int i = 0; i < npages; i++)
+    if(pages[i])
+      kfree(pages[i]);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +68,19 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kcachealloc(pipecache)) == 0)
     goto bad;
+  memset(pi->pages, 0, sizeof(pi->pages));
+  if((pi->pages[0] = kalloc()) == 0)
+    goto bad;
+  pi->size = PIPESIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->wbusy = 0;
+  pi->rbusy = 0;
+  initlockstat(&pi->lock, "pipe", pipestat);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,8 +92,10 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    pipefreepages(pi->pages, PIPEMAXPAGES);
+    kcachefree(pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,13 +116,16 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefreepages(pi->pages, pi->size / PGSIZE);
+    kcachefree(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes at addr to pi. If user_src==1, then addr is
+// a user virtual address; otherwise, addr is a kernel address.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
   int i = 0;
   struct proc *pr = myproc();
@@ -85,15 +136,22 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + pi->size || pi->wbusy){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // copy as much as fits before the end of a ring page.
+      uint m, contig;
+      char *dst = pipebyte(pi, pi->nwrite, &contig);
+      m = pi->nread + pi->size - pi->nwrite;
+      if(m > contig)
+        m = contig;
+      if(m > n - i)
+        m = n - i;
+      if(either_copyin(dst, user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -102,29 +160,290 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Read up to n bytes from pi to addr. If user_dst==1, then
+// addr is a user virtual address; otherwise, addr is a kernel
+// address.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; ){  //DOC: piperead-copy
+    uint m, contig;
+    char *src;
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    src = pipebyte(pi, pi->nread, &contig);
+    m = pi->nwrite - pi->nread;
+    if(m > contig)
+      m = contig;
+    if(m > n - i)
+      m = n - i;
+    if(either_copyout(user_dst, addr + i, src, m) == -1)
       break;
+    pi->nread += m;
+    i += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Set the capacity of pi to at least size bytes, rounded up to
+// a power-of-two number of pages, and return the new capacity.
+// size 0 just returns the current capacity. The pipe can't
+// shrink below the data it currently holds.
+int
+pipesize(struct pipe *pi, int size)
+{
+  char *pages[PIPEMAXPAGES];
+  uint newsize, used, off, m, contig;
+  int npages, i;
+
+  if(size < 0 || size > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  if(size == 0){
+    acquire(&pi->lock);
+    newsize = pi->size;
+    release(&pi->lock);
+    return newsize;
+  }
+  for(newsize = PGSIZE; newsize < size; newsize *= 2)
+    ;
+  npages = newsize / PGSIZE;
+
+  memset(pages, 0, sizeof(pages));
+  for(i = 0; i < npages; i++){
+    if((pages[i] = kalloc()) == 0){
+      pipefreepages(pages, npages);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  // a splice may be using the ring outside the lock.
+  while(pi->wbusy || pi->rbusy)
+    sleep(&pi->nwrite, &pi->lock);
+  used = pi->nwrite - pi->nread;
+  if(used > newsize){
+    release(&pi->lock);
+    pipefreepages(pages, npages);
+    return -1;
+  }
+  // copy the unread data to the start of the new ring.
+  for(off = 0; off < used; off += m){
+    char *src = pipebyte(pi, pi->nread + off, &contig);
+    m = used - off;
+    if(m > contig)
+      m = contig;
+    if(m > PGSIZE - off % PGSIZE)
+      m = PGSIZE - off % PGSIZE;
+    memmove(pages[off / PGSIZE] + off % PGSIZE, src, m);
+  }
+  // swap rings; pages[] then holds the old one to free.
+  for(i = 0; i < PIPEMAXPAGES; i++){
+    char *old = pi->pages[i];
+    pi->pages[i] = pages[i];
+    pages[i] = old;
+  }
+  npages = pi->size / PGSIZE;
+  pi->size = newsize;
+  pi->nread = 0;
+  pi->nwrite = used;
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+
+  pipefreepages(pages, npages);
+  return newsize;
+}
+
+// splice() and tee() support: move data between a pipe's ring
+// and another file without a trip through user memory. While
+// pipefill() or pipedrain() works on a span of the ring with
+// the lock released, wbusy or rbusy keeps other writers or
+// readers (and pipesize()) away from it.
+
+static void
+pipeunbusy(struct pipe *pi, int *busy)
+{
+  *busy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+}
+
+// Read up to n bytes from file f straight into pi.
+// Stops early at end of file or on a short read.
+int
+pipefill(struct pipe *pi, struct file *f, int n)
+{
+  int total = 0, r;
+  uint m, contig;
+  char *dst;
+  struct proc *pr = myproc();
+
+  while(total < n){
+    acquire(&pi->lock);
+    while(pi->nwrite == pi->nread + pi->size || pi->wbusy){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return total > 0 ? total : -1;
+      }
+      wakeup(&pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+    }
+    if(pi->readopen == 0){
+      release(&pi->lock);
+      return total > 0 ? total : -1;
+    }
+    dst = pipebyte(pi, pi->nwrite, &contig);
+    m = pi->nread + pi->size - pi->nwrite;
+    if(m > contig)
+      m = contig;
+    if(m > n - total)
+      m = n - total;
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    r = fileread(f, 0, (uint64)dst, m);
+
+    acquire(&pi->lock);
+    if(r > 0)
+      pi->nwrite += r;
+    pipeunbusy(pi, &pi->wbusy);
+    release(&pi->lock);
+
+    if(r < 0)
+      return total > 0 ? total : -1;
+    total += r;
+    if(r < m)
+      break;
+  }
+  return total;
+}
+
+// Move up to n bytes from the front of pipe a to pipe b, ring
+// to ring, waiting until a has data and b has room. The copy
+// is made holding both locks, taken in address order. Draining
+// a into pipewrite() instead would sleep on a full b with a's
+// rbusy set, and two splices in opposite directions between two
+// full pipes would then wait for each other forever. Here
+// nothing is held while sleeping but the lock slept on.
+static int
+pipetopipe(struct pipe *a, struct pipe *b, int n, int consume)
+{
+  struct pipe *first = a < b ? a : b, *second = a < b ? b : a;
+  uint m, done, k, ca, cb;
+  char *src, *dst;
+  struct proc *pr = myproc();
+
+  for(;;){
+    acquire(&first->lock);
+    acquire(&second->lock);
+    if(b->readopen == 0 || killed(pr)){
+      release(&second->lock);
+      release(&first->lock);
+      return -1;
+    }
+    if((a->nread == a->nwrite && a->writeopen) || a->rbusy){
+      release(&b->lock);
+      sleep(&a->nread, &a->lock);
+      release(&a->lock);
+      continue;
+    }
+    if(a->nread != a->nwrite &&
+       (b->nwrite == b->nread + b->size || b->wbusy)){
+      wakeup(&b->nread);
+      release(&a->lock);
+      sleep(&b->nwrite, &b->lock);
+      release(&b->lock);
+      continue;
+    }
+    break;
+  }
+
+  // a holds data (or is at end of file) and b has room.
+  m = a->nwrite - a->nread;
+  if(m > b->nread + b->size - b->nwrite)
+    m = b->nread + b->size - b->nwrite;
+  if(m > n)
+    m = n;
+  for(done = 0; done < m; done += k){
+    src = pipebyte(a, a->nread + done, &ca);
+    dst = pipebyte(b, b->nwrite + done, &cb);
+    k = m - done;
+    if(k > ca)
+      k = ca;
+    if(k > cb)
+      k = cb;
+    memmove(dst, src, k);
+  }
+  b->nwrite += m;
+  wakeup(&b->nread);
+  if(consume){
+    a->nread += m;
+    wakeup(&a->nwrite);
+  }
+  release(&second->lock);
+  release(&first->lock);
+  return m;
+}
+
+// Write up to n bytes from the front of pi to file f, waiting
+// only if pi is empty. If consume is 0 (tee), the data is left
+// in pi for its reader.
+int
+pipedrain(struct pipe *pi, struct file *f, int n, int consume)
+{
+  uint start, avail, off, m, contig;
+  int r = 0;
+  char *src;
+  struct proc *pr = myproc();
+
+  if(f->type == FD_PIPE)
+    return pipetopipe(pi, f->pipe, n, consume);
+
+  acquire(&pi->lock);
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){
+    if(killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  start = pi->nread;
+  avail = pi->nwrite - pi->nread;
+  if(avail > n)
+    avail = n;
+  pi->rbusy = 1;
+  release(&pi->lock);
+
+  // writers only touch the ring after nwrite, so the span
+  // [start, start+avail) stays put while rbusy is set.
+  for(off = 0; off < avail; off += r){
+    src = pipebyte(pi, start + off, &contig);
+    m = avail - off;
+    if(m > contig)
+      m = contig;
+    if((r = filewrite(f, 0, (uint64)src, m)) <= 0)
+      break;
+  }
+
+  acquire(&pi->lock);
+  if(consume)
+    pi->nread += off;
+  pipeunbusy(pi, &pi->rbusy);
+  release(&pi->lock);
+
+  if(off == 0 && r < 0)
+    return -1;
+  return off;
+}
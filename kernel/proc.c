@@ -3,7 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "vdata.h"
+#include "futex.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -15,6 +18,11 @@ struct proc *initproc;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void wakeidle(void);
+static void ruchildren(struct proc *p, struct proc *child);
+
+// number of harts that have entered scheduler().
+int ncpuonline;
 
 extern char trampoline[]; // trampoline.S
 
@@ -24,6 +32,9 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// protects the futex sleep/wakeup protocol; see kfutex().
+struct spinlock futex_lock;
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -49,9 +60,13 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&futex_lock, "futex");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->vmlock, "vmlock");
+      initlock(&p->fdlock, "fdlock");
       p->state = UNUSED;
+      p->timer.cpu = -1;
       p->kstack = KSTACK((int) (p - proc));
   }
 }
@@ -102,10 +117,11 @@ allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. A thread gets no page table
+// of its own; kclone() gives it the process's.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int thread)
 {
   struct proc *p;
 
@@ -127,10 +143,15 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
-  // initialize mmap regions
-  for (int i = 0; i < MAX_MMAPS; i++) {
-    p->mmaps[i].used = 0;
-  }
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
+  p->nmmaps = 0;
+  p->mmap_base = p->mmap_next = MMAPBASE;
+  p->mmapbusy = 0;
+  p->fault_next = 0;
+  p->fault_batch = 0;
+  p->leader = p;
+  p->tslot = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -139,12 +160,23 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+  if(!thread){
+    // Allocate the page of read-only data for user space.
+    if((p->usyscall = (struct usyscall *)kalloc()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    memset(p->usyscall, 0, PGSIZE);
+    p->usyscall->pid = p->pid;
+
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
   }
 
   // Set up new context to start executing at forkret,
@@ -165,12 +197,24 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
+  // a thread's page table is its process's; kexit() took out
+  // the thread's trapframe.
+  if(p->pagetable && p->leader == p){
+    mmapfree(p);
     proc_freepagetable(p->pagetable, p->sz);
+  }
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
+  p->leader = 0;
+  p->tslot = 0;
+  p->uringf = 0;
+  p->uring = 0;
+  p->uringva = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -178,11 +222,6 @@ freeproc(struct proc *p)
   p->traced = 0;  // Clear tracing flag
   p->tracing = 0; // Clear tracing flag
 
-  // clear mmap regions
-  for (int i = 0; i < MAX_MMAPS; i++) {
-    p->mmaps[i].used = 0;
-  }
-  
   p->state = UNUSED;
   p->syscall_count = 0;
 }
@@ -218,6 +257,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the read-only data pages below it, for user code
+  // that wants the pid, the time and so on without a trap.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  if(mappages(pagetable, VDATA, PGSIZE,
+              (uint64)vdata, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, USYSCALL, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -228,6 +285,8 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmunmap(pagetable, VDATA, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -237,7 +296,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   p->cwd = namei("/");
@@ -247,23 +306,36 @@ userinit(void)
   release(&p->lock);
 }
 
-// Shrink user memory by n bytes.
+// Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
 
+  acquire(&p->vmlock);
   sz = p->sz;
   if(n > 0){
+    if(sz + n > p->mmap_next){
+      release(&p->vmlock);
+      return -1;
+    }
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&p->vmlock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    uint64 newsz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(newsz == sz && sz + n < sz){
+      // couldn't split a megapage; nothing was freed.
+      release(&p->vmlock);
+      return -1;
+    }
+    sz = newsz;
   }
   p->sz = sz;
+  release(&p->vmlock);
   return 0;
 }
 
@@ -275,19 +347,30 @@ kfork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *lp = p->leader;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. Only the calling
+  // thread is copied.
+  acquire(&lp->vmlock);
+  if(uvmcopy(lp->pagetable, np->pagetable, lp->sz) < 0){
+    release(&lp->vmlock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->sz = lp->sz;
+  if(mmapcopy(lp, np) < 0){
+    release(&lp->vmlock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  release(&lp->vmlock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -296,10 +379,18 @@ kfork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&lp->fdlock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(lp->ofile[i])
+      np->ofile[i] = filedup(lp->ofile[i]);
+  np->cwd = idup(lp->cwd);
+  release(&lp->fdlock);
+  // the child's copy of the ring mapping is the same ring.
+  if(lp->uringf){
+    np->uringf = filedup(lp->uringf);
+    np->uring = lp->uring;
+    np->uringva = lp->uringva;
+  }
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -311,16 +402,178 @@ kfork(void)
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  np->parent = lp;
   release(&wait_lock);
 
   acquire(&np->lock);
   np->state = RUNNABLE;
   release(&np->lock);
+  wakeidle();
 
   return pid;
 }
 
+// Create a thread of the current process: a proc that shares
+// its page table, and with it the heap and mmap()ed regions,
+// and starts at user address fn with arg in a0 and its stack
+// pointer at stack. The thread also shares the process's file
+// descriptor table and current directory.
+// Returns the thread's id (a pid), or -1.
+int
+kclone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int t, tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *lp = p->leader;
+
+  if(stack % 16 != 0)
+    return -1;
+
+  // hold wait_lock throughout, so that killthreads() either
+  // sees the new thread or stops it from being made.
+  acquire(&wait_lock);
+  if(killed(lp) || (np = allocproc(1)) == 0){
+    release(&wait_lock);
+    return -1;
+  }
+
+  // map the thread's trapframe in a free slot.
+  acquire(&lp->vmlock);
+  for(t = 1; t < NTHREAD; t++)
+    if(!ismapped(lp->pagetable, THREADFRAME(t)))
+      break;
+  if(t == NTHREAD || mappages(lp->pagetable, THREADFRAME(t), PGSIZE,
+                              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    release(&lp->vmlock);
+    freeproc(np);
+    release(&np->lock);
+    release(&wait_lock);
+    return -1;
+  }
+  release(&lp->vmlock);
+  np->leader = lp;
+  np->tslot = t;
+  np->pagetable = lp->pagetable;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->traced = p->traced;
+  tid = np->pid;
+
+  np->state = RUNNABLE;
+  release(&np->lock);
+  release(&wait_lock);
+  wakeidle();
+
+  return tid;
+}
+
+// Wait for thread tid of the current process to exit, and
+// copy its exit status to addr if that isn't 0.
+// Return 0, or -1 if there is no such thread.
+int
+kjoin(int tid, uint64 addr)
+{
+  struct proc *pp;
+  int found;
+  struct proc *p = myproc();
+  struct proc *lp = p->leader;
+
+  acquire(&wait_lock);
+
+  for(;;){
+    found = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp->leader != lp || pp == lp || pp == p)
+        continue;
+      acquire(&pp->lock);
+      if(pp->pid == tid){
+        found = 1;
+        if(pp->state == ZOMBIE){
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                  sizeof(pp->xstate)) < 0) {
+            release(&pp->lock);
+            release(&wait_lock);
+            return -1;
+          }
+          ruchildren(lp, pp);
+          freeproc(pp);
+          release(&pp->lock);
+          release(&wait_lock);
+          return 0;
+        }
+      }
+      release(&pp->lock);
+    }
+
+    if(!found || killed(p)){
+      release(&wait_lock);
+      return -1;
+    }
+
+    // exiting threads wake their process.
+    sleep(lp, &wait_lock);
+  }
+}
+
+// Does p have threads, live or not yet joined?
+int
+hasthreads(struct proc *p)
+{
+  struct proc *pp;
+  int n = 0;
+
+  acquire(&wait_lock);
+  for(pp = proc; pp < &proc[NPROC]; pp++)
+    if(pp->leader == p && pp != p)
+      n++;
+  release(&wait_lock);
+  return n > 0;
+}
+
+// Kill p's threads and wait for them to exit, before p frees
+// the address space they share. Marks p killed, so that no
+// more threads are made.
+static void
+killthreads(struct proc *p)
+{
+  struct proc *pp;
+  int alive;
+
+  acquire(&wait_lock);
+  setkilled(p);
+  for(;;){
+    alive = 0;
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      if(pp->leader != p || pp == p)
+        continue;
+      acquire(&pp->lock);
+      if(pp->state == ZOMBIE){
+        // nobody will join it now.
+        ruchildren(p, pp);
+        freeproc(pp);
+      } else {
+        alive = 1;
+        pp->killed = 1;
+        if(pp->state == SLEEPING)
+          pp->state = RUNNABLE;
+      }
+      release(&pp->lock);
+    }
+    if(!alive)
+      break;
+    wakeidle();
+    sleep(p, &wait_lock);
+  }
+  release(&wait_lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -347,27 +600,47 @@ kexit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  if(p->leader == p){
+    // the address space goes with the process, so its
+    // threads go first. Then unmap mmap()ed files, writing
+    // back shared pages.
+    killthreads(p);
+    mmapclose(p);
+    uringclose(p);
+
+    // Close all open files; with the threads gone, nothing
+    // else uses them.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(p->ofile[fd]){
+        struct file *f = p->ofile[fd];
+        fileclose(f);
+        p->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(p->cwd);
+    end_op();
+    p->cwd = 0;
+  } else {
+    // free the thread's trapframe slot; it won't go back to
+    // user space. The files and cwd are the process's.
+    acquire(&p->leader->vmlock);
+    uvmunmap(p->pagetable, THREADFRAME(p->tslot), 1, 0);
+    release(&p->leader->vmlock);
+  }
 
   acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  // Parent might be sleeping in wait(); a thread's process
+  // might be in join() or killthreads().
+  if(p->leader == p)
+    wakeup(p->parent);
+  else
+    wakeup(p->leader);
   
   acquire(&p->lock);
 
@@ -383,12 +656,14 @@ kexit(int status)
 
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Any thread of a process can wait for its children.
 int
 kwait(uint64 addr)
 {
   struct proc *pp;
   int havekids, pid;
   struct proc *p = myproc();
+  struct proc *lp = p->leader;
 
   acquire(&wait_lock);
 
@@ -396,7 +671,7 @@ kwait(uint64 addr)
     // Scan through table looking for exited children.
     havekids = 0;
     for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+      if(pp->parent == lp){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -410,6 +685,7 @@ kwait(uint64 addr)
             release(&wait_lock);
             return -1;
           }
+          ruchildren(lp, pp);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -426,8 +702,122 @@ kwait(uint64 addr)
     }
     
     // Wait for a child to exit.
-    sleep(p, &wait_lock);  //DOC: wait-sleep
+    sleep(lp, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Is any process RUNNABLE? Looks without taking locks, so
+// the answer is only a hint; idle() uses it to close the
+// window between its last scan and wfi.
+static int
+anyrunnable(void)
+{
+  struct proc *p;
+
+  for(p = proc; p < &proc[NPROC]; p++){
+    if(p->state == RUNNABLE)
+      return 1;
+  }
+  return 0;
+}
+
+// Nothing to run: park this hart in wfi until an interrupt,
+// instead of spinning through the proc table. A CPU that makes
+// a process RUNNABLE sends an IPI (see wakeidle()) to cut the
+// nap short. Called with interrupts on; returns with them on.
+static void
+idle(struct cpu *c)
+{
+  uint64 t0;
+
+  // wfi wakes for any interrupt enabled in sie, even with
+  // sstatus.SIE clear, so keeping interrupts off until after
+  // wfi means an IPI that arrives after the check below
+  // can't be handled (and lost) before we go to sleep.
+  intr_off();
+
+  // publish c->idle before looking at the proc table one more
+  // time. wakeidle() does the reverse (state, then c->idle),
+  // so either we see the new RUNNABLE process or it sees us.
+  c->idle = 1;
+  __sync_synchronize();
+  if(anyrunnable()){
+    c->idle = 0;
+    intr_on();
+    return;
+  }
+
+  t0 = r_time();
+  asm volatile("wfi");
+  c->idletime += r_time() - t0;
+  c->nidle++;
+  vdata->cpu[cpuid()].idletime = c->idletime;
+  vdata->cpu[cpuid()].nidle = c->nidle;
+  c->idle = 0;
+
+  intr_on();
+}
+
+// Wake one idle hart (other than this one), if there is any,
+// so that it picks up a process that was just made RUNNABLE.
+static void
+wakeidle(void)
+{
+  struct cpu *c;
+  int me;
+
+  __sync_synchronize();
+  push_off();
+  me = cpuid();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c - cpus == me || !c->idle)
+      continue;
+    // whoever clears c->idle sends the IPI, so a burst of
+    // wakeups costs the sleeping hart a single interrupt.
+    if(__sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      *(volatile uint32 *)CLINT_MSIP(c - cpus) = 1;
+      break;
+    }
+  }
+  pop_off();
+}
+
+// The caller has just cleared PTEs of the user page table
+// pagetable, and is about to free the pages they mapped: make
+// sure no other hart can still reach them through its TLB. A
+// hart only caches user translations while it runs in user mode,
+// and userret in trampoline.S flushes its TLB with sfence.vma on
+// every return there, so it is enough to IPI each hart that runs
+// a thread of this page table in user mode and wait until it has
+// trapped into the kernel.
+void
+tlbshootdown(pagetable_t pagetable)
+{
+  struct proc *p;
+  uint64 ntrap[NCPU];
+  int i, me, sent[NCPU];
+
+  // the PTE writes before the reads of c->inuser below.
+  __sync_synchronize();
+  push_off();
+  me = cpuid();
+  for(i = 0; i < NCPU; i++){
+    sent[i] = 0;
+    ntrap[i] = *(volatile uint64 *)&cpus[i].ntrap;
+    if(i == me || !*(volatile int *)&cpus[i].inuser)
+      continue;
+    __sync_synchronize();
+    if((p = cpus[i].proc) == 0 || p->pagetable != pagetable)
+      continue;
+    *(volatile uint32 *)CLINT_MSIP(i) = 1;
+    sent[i] = 1;
   }
+  // a hart in user mode takes the IPI at once, whatever it was
+  // doing, so this doesn't wait on any lock.
+  for(i = 0; i < NCPU; i++)
+    while(sent[i] && *(volatile uint64 *)&cpus[i].ntrap == ntrap[i])
+      ;
+  pop_off();
 }
 
 // Per-CPU process scheduler.
@@ -437,18 +827,22 @@ kwait(uint64 addr)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+//  - if there was nothing to run, idle() until an interrupt.
 void
 scheduler(void)
 {
   //struct proc *p;
   struct cpu *c = mycpu();
   c->proc = 0;
+  __sync_fetch_and_add(&ncpuonline, 1);
+  __sync_fetch_and_add(&vdata->ncpu, 1);
   for(;;){
       // enable interrupts on this CPU.
       intr_on();
 
       // Find maximum priority among RUNNABLE processes (0..3)
       int maxprio = 0;
+      int found = 0;
       struct proc *p;
       for(p = proc; p < &proc[NPROC]; p++){
         acquire(&p->lock);
@@ -468,17 +862,29 @@ scheduler(void)
 
           // Found runnable process with priority >= target
           p->state = RUNNING;
+          // give it a fresh time slice, and make sure a timer
+          // interrupt will come to end it.
+          c->slice_end = r_time() + quantum;
+          if(c->slice_end < r_stimecmp())
+            w_stimecmp(c->slice_end);
           // switch to it
           c->proc = p;
+          vdata->cpu[cpuid()].pid = p->pid;
+          p->tstamp = r_time();
           swtch(&c->context, &p->context);
           // back here after process yields
           c->proc = 0;
+          vdata->cpu[cpuid()].pid = 0;
           release(&p->lock);
+          found = 1;
 
           // optional: recompute maxprio to skip remaining levels if no higher ones exist
           // (simple optimization—safe to omit if you want simpler code)
         }
       }
+
+      if(found == 0)
+        idle(c);
     }
 }
 
@@ -504,6 +910,10 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  // charge the time since the last transition as system
+  // time; scheduler() restarts the clock when p runs again.
+  p->ru.stime += r_time() - p->tstamp;
+
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -516,6 +926,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->ru.nivcsw++;
   sched();
   release(&p->lock);
 }
@@ -577,6 +988,7 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
 
   sched();
 
@@ -594,16 +1006,20 @@ void
 wakeup(void *chan)
 {
   struct proc *p;
+  int woke = 0;
 
   for(p = proc; p < &proc[NPROC]; p++) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
         p->state = RUNNABLE;
+        woke = 1;
       }
       release(&p->lock);
     }
   }
+  if(woke)
+    wakeidle();
 }
 
 // Kill the process with the given pid.
@@ -623,6 +1039,7 @@ kkill(int pid)
         p->state = RUNNABLE;
       }
       release(&p->lock);
+      wakeidle();
       return 0;
     }
     release(&p->lock);
@@ -630,6 +1047,73 @@ kkill(int pid)
   return -1;
 }
 
+// futex(addr, op, val): FUTEX_WAIT sleeps if the int at user
+// address addr still holds val, until a FUTEX_WAKE on the same
+// word; FUTEX_WAKE wakes at most val of its waiters and returns
+// how many it woke. The sleep channel is the word's physical
+// address, so threads, and processes sharing memory, agree on it.
+int
+kfutex(uint64 addr, int op, int val)
+{
+  struct proc *p = myproc();
+  struct proc *pp;
+  pte_t *pte;
+  uint64 pa;
+  int v, n;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+  // copyin() faults the page in if need be. Then make it
+  // writable: a write to the zero page, or to a private file
+  // page, would move the word to another physical address under
+  // the waiters.
+  if(copyin(p->pagetable, (char *)&v, addr, sizeof(v)) < 0)
+    return -1;
+  if((pte = walk(p->pagetable, addr, 0)) == 0 || (*pte & PTE_W) == 0){
+    if(vmfault(p->pagetable, addr, 0) == 0)
+      return -1;
+  }
+
+  acquire(&futex_lock);
+  if((pa = walkaddr(p->pagetable, addr)) == 0){
+    release(&futex_lock);
+    return -1;
+  }
+  pa += addr % PGSIZE;
+
+  if(op == FUTEX_WAIT){
+    // the waker changes the word before calling FUTEX_WAKE,
+    // which takes futex_lock, so checking it under the lock
+    // can't miss a wakeup.
+    if(*(volatile int *)pa != val || killed(p)){
+      release(&futex_lock);
+      return -1;
+    }
+    sleep((void *)pa, &futex_lock);
+    release(&futex_lock);
+    return 0;
+  }
+
+  if(op == FUTEX_WAKE){
+    n = 0;
+    for(pp = proc; pp < &proc[NPROC] && n < val; pp++){
+      acquire(&pp->lock);
+      if(pp->state == SLEEPING && pp->chan == (void *)pa){
+        pp->state = RUNNABLE;
+        n++;
+      }
+      release(&pp->lock);
+    }
+    release(&futex_lock);
+    if(n > 0)
+      wakeidle();
+    return n;
+  }
+
+  release(&futex_lock);
+  return -1;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -689,11 +1173,28 @@ strace(struct proc *p, int num, int retval)
 
 }
 
-// Wait for a child to exit, returning its pid and filling in status/syscall count.
-int
-wait2(uint64 ustatus, uint64 usyscalls)
+// Add child's usage, and that of the children it waited for,
+// to the totals of p's waited-for children.
+static void
+ruchildren(struct proc *p, struct proc *child)
+{
+  uint64 *dst = (uint64 *)&p->cru;
+  uint64 *a = (uint64 *)&child->ru;
+  uint64 *b = (uint64 *)&child->cru;
+
+  for(int i = 0; i < sizeof(struct rusage) / sizeof(uint64); i++)
+    dst[i] += a[i] + b[i];
+}
+
+// Wait for a child to exit and return its pid. If they are
+// non-zero, copy out its exit status, syscall count and
+// resource usage to the user addresses ustatus, usyscalls and
+// urusage. Return -1 if this process has no children.
+static int
+waitchild(uint64 ustatus, uint64 usyscalls, uint64 urusage)
 {
   struct proc *p = myproc();
+  struct proc *lp = p->leader;
   struct proc *np;
   int havekids, pid;
 
@@ -702,7 +1203,7 @@ wait2(uint64 ustatus, uint64 usyscalls)
   for(;;){
     havekids = 0;
     for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+      if(np->parent == lp){
         havekids = 1;
         acquire(&np->lock);
         if(np->state == ZOMBIE){
@@ -721,6 +1222,14 @@ wait2(uint64 ustatus, uint64 usyscalls)
             release(&wait_lock);
             return -1;
           }
+          if(urusage != 0 &&
+             copyout(p->pagetable, urusage, (char *)&np->ru,
+                     sizeof(np->ru)) < 0){
+            release(&np->lock);
+            release(&wait_lock);
+            return -1;
+          }
+          ruchildren(lp, np);
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
@@ -733,10 +1242,47 @@ wait2(uint64 ustatus, uint64 usyscalls)
       release(&wait_lock);
       return -1;
     }
-    sleep(p, &wait_lock);
+    sleep(lp, &wait_lock);
   }
 }
 
+// Wait for a child to exit, returning its pid and filling in status/syscall count.
+int
+wait2(uint64 ustatus, uint64 usyscalls)
+{
+  return waitchild(ustatus, usyscalls, 0);
+}
+
+// Wait for a child to exit, returning its pid and filling in
+// status and the child's resource usage.
+int
+kwait3(uint64 ustatus, uint64 urusage)
+{
+  return waitchild(ustatus, 0, urusage);
+}
+
+// Copy out the resource usage of the current process
+// (RUSAGE_SELF) or of its waited-for children (RUSAGE_CHILDREN).
+int
+kgetrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage *ru;
+
+  if(who == RUSAGE_SELF){
+    // bring stime up to date.
+    uint64 now = r_time();
+    p->ru.stime += now - p->tstamp;
+    p->tstamp = now;
+    ru = &p->ru;
+  } else if(who == RUSAGE_CHILDREN){
+    ru = &p->cru;
+  } else {
+    return -1;
+  }
+  return copyout(p->pagetable, addr, (char *)ru, sizeof(*ru));
+}
+
 
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -775,57 +1321,29 @@ procdump(void)
     printf("\n");
   }
 
+  for(int i = 0; i < ncpuonline && i < NCPU; i++)
+    printf("hart %d idle %ld cycles in %ld naps\n", i,
+           cpus[i].idletime, cpus[i].nidle);
 }
 
-uint64
-kmmap(uint64 addr, int length, int prot, int flags, int fd, int offset)
-{
-    struct proc *p = myproc();
-    if (length != PGSIZE)
-        return -1;
-
-    if (addr == 0)
-        addr = 0x40000000UL;
-
-    char *mem = kalloc();
-    if (mem == 0)
-        return -1;
-
-    if (mappages(p->pagetable, addr, PGSIZE, (uint64)mem, PTE_U | PTE_R | PTE_W) < 0){
-        kfree(mem);
-        return -1;
-    }
-
-    // store in mmaps[]
-    for (int i = 0; i < MAX_MMAPS; i++) {
-        if (!p->mmaps[i].used) {
-            p->mmaps[i].used = 1;
-            p->mmaps[i].addr = addr;
-            p->mmaps[i].pa = (uint64)mem;
-            break;
-        }
-    }
-
-    // **IMPORTANT**: update process size if addr is beyond current size
-    if (addr + PGSIZE > p->sz)
-        p->sz = addr + PGSIZE;
-
-    return addr;
-}
-
-uint64
-kmunmap(uint64 addr, int length)
+// Copy out each online hart's time spent idle in wfi (in time
+// CSR cycles) to the user array addr of n entries.
+// Returns the number of online harts, or -1 on error.
+int
+cpuidle(uint64 addr, int n)
 {
-    struct proc *p = myproc();
-
-    for (int i = 0; i < MAX_MMAPS; i++) {
-        if (p->mmaps[i].used && p->mmaps[i].addr == addr) {
-            uvmunmap(p->pagetable, addr, 1, 1);  // removes + frees
-            p->mmaps[i].used = 0;
-            return 0;
-        }
-    }
+  struct proc *p = myproc();
+  uint64 idle[NCPU];
+  int i, ncpu;
 
+  ncpu = ncpuonline;
+  if(n > ncpu)
+    n = ncpu;
+  if(n < 0)
+    return -1;
+  for(i = 0; i < n; i++)
+    idle[i] = cpus[i].idletime;
+  if(n > 0 && copyout(p->pagetable, addr, (char *)idle, n * sizeof(uint64)) < 0)
     return -1;
+  return ncpu;
 }
-
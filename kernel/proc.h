@@ -24,6 +24,12 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // Parked in wfi; wake it with an IPI.
+  uint64 idletime;            // time CSR cycles spent parked in wfi.
+  uint64 nidle;               // Number of times this cpu went idle.
+  uint64 slice_end;           // time CSR value when c->proc's slice ends.
+  int inuser;                 // Running c->proc in user mode.
+  uint64 ntrap;               // Traps from user mode; see tlbshootdown().
 };
 
 // per-process data for the trap handling code in trampoline.S.
@@ -77,6 +83,14 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// One-shot timer, on a per-CPU queue sorted by deadline.
+// see timer.c.
+struct timer {
+  uint64 deadline;             // absolute time CSR value
+  int cpu;                     // queue it's on, or -1 if not armed
+  struct timer *next;          // next timer on that queue
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 void strace(struct proc *p, int num, int retval);
@@ -85,17 +99,16 @@ int wait2(uint64 ustatus, uint64 usyscalls);
 
 // ----- mmap bookkeeping -----
 
-#define MAX_MMAPS 16
+#define MAX_MMAPS 32
 
+// One mmap()ed range; see mmap.c.
 struct mmap_region {
-    int used;       // 0 = free, 1 = used
-    uint64 pa;      // physical address of the page
-    uint64 addr;    // virtual address in the process
-    int length;     // length of the mapping (in bytes or pages)
-    int prot;       // protection flags (PTE_R | PTE_W | PTE_U)
-    int flags;      // mapping flags (MAP_ANONYMOUS, etc.)
-    int fd;         // file descriptor, if mapping a file
-    int offset;     // offset into the file
+    uint64 addr;    // virtual address in the process, page-aligned
+    uint64 length;  // length of the mapping, a multiple of PGSIZE
+    int prot;       // PROT_READ, PROT_WRITE
+    int flags;      // MAP_ANON, MAP_PRIVATE, MAP_SHARED
+    struct file *f; // mapped file, or 0 if MAP_ANON
+    int offset;     // offset into the file of addr
 };
 
 // Per-process state
@@ -112,31 +125,58 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  struct timer timer;          // For timersleep(); its queue's lock guards it
+
   int traced;                  // Tracing flag (0 = off, 1 = on)
   int tracing;                 // 1 if strace enabled
 
 
-  // wait_lock must be held when using this:
-  struct proc *parent;         // Parent process
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process; 0 for a thread
+  struct proc *leader;         // Owner of the address space: p itself,
+                               // or the process that p is a thread of
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes); see vmlock
+  pagetable_t pagetable;       // User page table, shared by threads
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // read-only page mapped at USYSCALL
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct file *ofile[NOFILE];  // Open files; see fdlock
+  struct inode *cwd;           // Current directory; see fdlock
   char name[16];               // Process name (debugging)
 
+  struct rusage ru;            // Resource usage of this process
+  struct rusage cru;           // Summed usage of waited-for children
+  uint64 tstamp;               // time CSR at last user/kernel/switch transition
+
   int nice;      // niceness (0..3) where 0 = highest priority, 3 = lowest nice
   int priority;  // effective priority (0..3) where 3 = highest scheduling priority
 
+  int tslot;                   // THREADFRAME slot; 0 unless a thread
+
+  // A process's threads share its page table and use the fields
+  // below in p->leader only. vmlock must be held to change them or
+  // the page table; mmapbusy serializes mmap(), munmap() and msync().
+  struct spinlock vmlock;
+  int mmapbusy;
+  uint64 fault_next;  // page after the last heap fault's batch
+  int fault_batch;    // pages in that batch; see vmfault()
   uint64 mmap_base;   // top of mmap area (exclusive upper bound)
-  uint64 mmap_next;   // next free VA in mmap area (decreases)
-  struct mmap_region mmaps[MAX_MMAPS];
-      
-  
+  uint64 mmap_next;   // lowest mapped VA, or mmap_base; sbrk() stops here
+  struct mmap_region mmaps[MAX_MMAPS];  // sorted by addr
+  int nmmaps;
+
+  // threads share ofile and cwd, in p->leader only; fdlock must
+  // be held to use them.
+  struct spinlock fdlock;
+
+  // the ring from uring_setup(), shared with the process; in
+  // the leader only.
+  struct file *uringf;   // its segment, or 0
+  struct uring *uring;   // kernel address of the ring
+  uint64 uringva;        // where it is mapped in the process
 };
 
 extern struct cpu cpus[NCPU];
@@ -0,0 +1,249 @@
+// Sampling profiler.
+//
+// While profiling is on, clockintr() calls proftick() on every
+// timer interrupt, and each CPU records a sample every
+// prof.interval time CSR cycles: the interrupted pc, the pid of
+// the running process, and a short frame-pointer backtrace of
+// whatever was interrupted (user or kernel code). Samples go
+// in a per-CPU ring; profread() drains the rings into a user
+// buffer, blocking until there is something to read or until
+// profiling is stopped.
+//
+// profnext() tells clockintr() when the next sample is due so
+// that it can program stimecmp for it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+#define PROFNBUF 512  // samples per CPU ring
+#define PROFBATCH 8   // samples profread() copies out at a time
+
+extern char kernelvec_ret[];  // kernelvec.S
+
+struct profcpu {
+  uint64 next;      // time CSR value when the next sample is due
+  uint head;        // next slot to write; head - tail samples queued
+  uint tail;        // next slot to read
+  uint64 dropped;   // samples lost to a full ring
+  struct profsample buf[PROFNBUF];
+};
+
+struct {
+  struct spinlock lock;
+  int on;
+  uint64 interval;  // time CSR cycles between samples
+  struct profcpu cpu[NCPU];
+} prof;
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+}
+
+// Read the user word at va (8-byte aligned) without faulting
+// anything in; we're in an interrupt handler.
+static int
+fetchuword(pagetable_t pagetable, uint64 va, uint64 *x)
+{
+  uint64 pa;
+
+  pa = walkaddr(pagetable, PGROUNDDOWN(va));
+  if(pa == 0)
+    return -1;
+  *x = *(uint64 *)(pa + (va - PGROUNDDOWN(va)));
+  return 0;
+}
+
+// Follow the user frame-pointer chain starting at fp.
+static int
+userstack(struct proc *p, uint64 fp, uint64 *stack)
+{
+  uint64 ra, prev;
+  int n;
+
+  for(n = 0; n < PROFDEPTH; n++){
+    if(fp < 16 || fp >= p->leader->sz || (fp % 8) != 0)
+      break;
+    if(fetchuword(p->pagetable, fp - 8, &ra) < 0 ||
+       fetchuword(p->pagetable, fp - 16, &prev) < 0)
+      break;
+    stack[n] = ra;
+    // stacks grow down, so callers' frames are higher.
+    if(prev <= fp)
+      break;
+    fp = prev;
+  }
+  return n;
+}
+
+// Follow the kernel frame-pointer chain of the code that the
+// timer interrupted. Our own callers (clockintr, devintr,
+// kerneltrap) come first; skip them until the frame whose
+// return address is kernelvec's, whose saved fp belongs to the
+// interrupted function. Kernel stacks are a single page.
+static int
+kernelstack(uint64 *stack)
+{
+  uint64 fp = r_fp();
+  uint64 page = PGROUNDDOWN(fp);
+  uint64 ra;
+  int i, n;
+
+  for(i = 0; ; i++){
+    if(i >= 8 || PGROUNDDOWN(fp - 16) != page)
+      return 0;
+    ra = *(uint64 *)(fp - 8);
+    fp = *(uint64 *)(fp - 16);
+    if(ra == (uint64)kernelvec_ret)
+      break;
+  }
+
+  for(n = 0; n < PROFDEPTH; n++){
+    if(fp < 16 || (fp % 8) != 0 || PGROUNDDOWN(fp - 16) != page)
+      break;
+    stack[n] = *(uint64 *)(fp - 8);
+    fp = *(uint64 *)(fp - 16);
+  }
+  return n;
+}
+
+// Called by clockintr() on every timer interrupt, with the
+// trap's sepc and sstatus still in their CSRs.
+void
+proftick(uint64 now)
+{
+  struct profcpu *pc;
+  struct profsample *s;
+  struct proc *p = myproc();
+
+  if(!prof.on)
+    return;
+
+  acquire(&prof.lock);
+  pc = &prof.cpu[cpuid()];
+  if(!prof.on || now < pc->next){
+    release(&prof.lock);
+    return;
+  }
+  pc->next = now + prof.interval;
+
+  if(pc->head - pc->tail >= PROFNBUF){
+    pc->dropped++;
+    release(&prof.lock);
+    return;
+  }
+
+  s = &pc->buf[pc->head % PROFNBUF];
+  s->pc = r_sepc();
+  s->pid = p ? p->pid : 0;
+  if((r_sstatus() & SSTATUS_SPP) == 0){
+    // interrupted user code; its registers are in the trapframe.
+    s->user = 1;
+    s->depth = userstack(p, p->trapframe->s0, s->stack);
+  } else {
+    s->user = 0;
+    s->depth = kernelstack(s->stack);
+  }
+  pc->head++;
+
+  // wake the reader once a ring is half full, rather than
+  // on every sample.
+  if(pc->head - pc->tail == PROFNBUF / 2)
+    wakeup(&prof);
+  release(&prof.lock);
+}
+
+// When this CPU's next sample is due, or ~0 if not profiling.
+uint64
+profnext(void)
+{
+  if(!prof.on)
+    return ~0UL;
+  return prof.cpu[cpuid()].next;
+}
+
+// Start (cmd PROF_START, sampling every usec microseconds)
+// or stop (PROF_STOP) profiling.
+int
+profctl(int cmd, int usec)
+{
+  uint64 now = r_time();
+
+  acquire(&prof.lock);
+  if(cmd == PROF_START){
+    if(usec < 100){
+      release(&prof.lock);
+      return -1;
+    }
+    for(int i = 0; i < NCPU; i++){
+      prof.cpu[i].head = prof.cpu[i].tail = 0;
+      prof.cpu[i].dropped = 0;
+      prof.cpu[i].next = now;
+    }
+    prof.interval = (uint64)usec * (TIMEBASE / 1000000);
+    prof.on = 1;
+    // other CPUs notice at their next timer interrupt; an idle
+    // one has nothing worth sampling until then anyway.
+    if(now + prof.interval < r_stimecmp())
+      w_stimecmp(now + prof.interval);
+  } else if(cmd == PROF_STOP){
+    prof.on = 0;
+    wakeup(&prof);
+  } else {
+    release(&prof.lock);
+    return -1;
+  }
+  release(&prof.lock);
+  return 0;
+}
+
+// Copy up to n queued samples to the user array addr. Waits
+// while profiling is on and there is nothing to read.
+// Returns the number of samples copied; 0 means profiling
+// is off and every sample has been read.
+// Samples are taken off the rings a batch at a time under
+// prof.lock, and copied out after it is released, since
+// copyout() may fault the user buffer in and sleep.
+int
+profread(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct profcpu *pc;
+  struct profsample batch[PROFBATCH];
+  int i, m, got = 0;
+
+  while(got < n){
+    acquire(&prof.lock);
+    for(;;){
+      m = 0;
+      for(i = 0; i < NCPU && m < PROFBATCH && got + m < n; i++){
+        pc = &prof.cpu[i];
+        while(pc->tail != pc->head && m < PROFBATCH && got + m < n)
+          batch[m++] = pc->buf[pc->tail++ % PROFNBUF];
+      }
+      if(m > 0 || got > 0 || !prof.on)
+        break;
+      if(killed(p)){
+        release(&prof.lock);
+        return -1;
+      }
+      sleep(&prof, &prof.lock);
+    }
+    release(&prof.lock);
+    if(m == 0)
+      break;
+    if(copyout(p->pagetable, addr + got * sizeof(struct profsample),
+               (char *)batch, m * sizeof(struct profsample)) < 0)
+      return -1;
+    got += m;
+  }
+  return got;
+}
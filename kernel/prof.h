@@ -0,0 +1,16 @@
+// Sampling profiler samples, read by profread().
+// Both the kernel and user programs use this header file.
+
+#define PROFDEPTH 8   // return addresses kept per sample
+
+struct profsample {
+  uint64 pc;                // interrupted pc (sepc)
+  uint64 stack[PROFDEPTH];  // return addresses, innermost first
+  int pid;                  // running process, or 0 if none
+  short user;               // pc is a user address?
+  short depth;              // number of valid stack[] entries
+};
+
+// profctl() commands
+#define PROF_STOP   0
+#define PROF_START  1   // discard old samples, then sample every usec
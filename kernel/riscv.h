@@ -79,6 +79,7 @@ w_sip(uint64 x)
 // Supervisor Interrupt Enable
 #define SIE_SEIE (1L << 9) // external
 #define SIE_STIE (1L << 5) // timer
+#define SIE_SSIE (1L << 1) // software
 static inline uint64
 r_sie()
 {
@@ -95,6 +96,7 @@ w_sie(uint64 x)
 
 // Machine-mode Interrupt Enable
 #define MIE_STIE (1L << 5)  // supervisor timer
+#define MIE_MSIE (1L << 3)  // machine software (CLINT msip)
 static inline uint64
 r_mie()
 {
@@ -118,6 +120,14 @@ w_sepc(uint64 x)
   asm volatile("csrw sepc, %0" : : "r" (x));
 }
 
+// Supervisor Scratch: the user virtual address of the
+// running thread's trapframe; see trampoline.S.
+static inline void
+w_sscratch(uint64 x)
+{
+  asm volatile("csrw sscratch, %0" : : "r" (x));
+}
+
 static inline uint64
 r_sepc()
 {
@@ -206,6 +216,35 @@ w_menvcfg(uint64 x)
   asm volatile("csrw 0x30a, %0" : : "r" (x));
 }
 
+// Supervisor Counter Enable: which counters user mode may read.
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+// Machine-mode interrupt vector
+static inline void 
+w_mtvec(uint64 x)
+{
+  asm volatile("csrw mtvec, %0" : : "r" (x));
+}
+
+// Machine Scratch register, for mswivec.
+static inline void 
+w_mscratch(uint64 x)
+{
+  asm volatile("csrw mscratch, %0" : : "r" (x));
+}
+
 // Physical Memory Protection
 static inline void
 w_pmpcfg0(uint64 x)
@@ -304,6 +343,16 @@ intr_get()
   return (x & SSTATUS_SIE) != 0;
 }
 
+// read s0, the frame pointer (the kernel and user programs
+// are built with -fno-omit-frame-pointer).
+static inline uint64
+r_fp()
+{
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x) );
+  return x;
+}
+
 static inline uint64
 r_sp()
 {
@@ -355,11 +404,16 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a megapage is mapped by a leaf PTE in a level-1 page table.
+#define MEGAPGSIZE (PGSIZE*512) // 2MB
+#define MEGAROUNDUP(sz)  (((sz)+MEGAPGSIZE-1) & ~(MEGAPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_MEGA (1L << 8) // software: a megapage leaf
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -368,6 +422,11 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// the physical address of the page holding va, which leaf pte
+// maps; pte may map the megapage around it.
+#define PTE2PAGE(pte, va) (PTE2PA(pte) + \
+  (((pte) & PTE_MEGA) ? PGROUNDDOWN(va) % MEGAPGSIZE : 0))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -0,0 +1,17 @@
+// Per-process resource usage, for getrusage() and wait3().
+// Times are in time CSR cycles (TIMEBASE per second).
+struct rusage {
+  uint64 utime;    // time spent in user mode
+  uint64 stime;    // time spent in the kernel on its behalf
+  uint64 nvcsw;    // voluntary context switches (sleep)
+  uint64 nivcsw;   // involuntary context switches (time slice ended)
+  uint64 nfault;   // page faults handled by vmfault()
+  uint64 nzero;    // of those, reads that mapped the shared zero page
+  uint64 inblock;  // disk blocks read
+  uint64 oublock;  // disk blocks written
+  uint64 incopy;   // bytes copied in from user memory
+  uint64 outcopy;  // bytes copied out to user memory
+};
+
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  1
@@ -0,0 +1,199 @@
+// Shared memory segments.
+//
+// A segment is a set of zero-filled pages that processes share
+// by mapping it MAP_SHARED. shm_open() finds or creates a named
+// segment, so unrelated processes can share it, and returns a
+// file descriptor to pass to mmap(). mmap(MAP_SHARED|MAP_ANON)
+// makes an unnamed segment, which fork() passes on to the child
+// along with the mapping.
+//
+// Pages are allocated when first touched, unless shmcontig()
+// allocated them all at once. The segment and each
+// PTE that maps a page hold a kalloc() reference to it, so a
+// page stays alive until the segment and its last mapping are
+// gone. A segment lives while a file refers to it or while it
+// has a name; shm_unlink() removes the name.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SHMNAME 16
+
+struct shm {
+  char name[SHMNAME];       // "" if unnamed
+  int ref;                  // files that refer to the segment
+  int npages;               // 0 if the slot is free
+  uint64 page[SHMPAGES];    // 0 until first touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shmtable");
+}
+
+// Free sh's pages and its slot, if nothing refers to it.
+// Caller must hold shmtable.lock.
+static void
+shmfree(struct shm *sh)
+{
+  int i;
+
+  if(sh->ref > 0 || sh->name[0] != 0)
+    return;
+  for(i = 0; i < sh->npages; i++){
+    if(sh->page[i])
+      kfree((void*)sh->page[i]);
+    sh->page[i] = 0;
+  }
+  sh->npages = 0;
+}
+
+// Return a file for the segment called name, creating it with
+// size bytes (rounded up to whole pages) if it doesn't exist and
+// omode has O_CREATE. An empty name makes a new unnamed segment.
+// Returns 0 on error.
+struct file*
+shmopen(char *name, int size, int omode)
+{
+  struct shm *sh, *free = 0;
+  struct file *f;
+  int npages = (size + PGSIZE - 1) / PGSIZE;
+
+  if(strlen(name) >= SHMNAME || size < 0)
+    return 0;
+  if((f = filealloc()) == 0)
+    return 0;
+
+  acquire(&shmtable.lock);
+  for(sh = shmtable.shm; sh < &shmtable.shm[NSHM]; sh++){
+    if(sh->npages == 0){
+      if(free == 0)
+        free = sh;
+    } else if(name[0] && strncmp(sh->name, name, SHMNAME) == 0){
+      break;
+    }
+  }
+  if(sh == &shmtable.shm[NSHM]){
+    if(!name[0])
+      omode |= O_CREATE;
+    if((omode & O_CREATE) == 0 || free == 0 || npages < 1 || npages > SHMPAGES){
+      release(&shmtable.lock);
+      fileclose(f);
+      return 0;
+    }
+    sh = free;
+    safestrcpy(sh->name, name, SHMNAME);
+    sh->npages = npages;
+  }
+  sh->ref++;
+  release(&shmtable.lock);
+
+  f->type = FD_SHM;
+  f->shm = sh;
+  f->readable = !(omode & O_WRONLY);
+  f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+// Drop a file's reference to sh. Called by fileclose().
+void
+shmclose(struct shm *sh)
+{
+  acquire(&shmtable.lock);
+  if(sh->ref < 1)
+    panic("shmclose");
+  sh->ref--;
+  shmfree(sh);
+  release(&shmtable.lock);
+}
+
+// Remove the name of a segment; it goes away once no file
+// refers to it. Returns 0, or -1 if there is no such segment.
+int
+shmunlink(char *name)
+{
+  struct shm *sh;
+
+  if(name[0] == 0)
+    return -1;
+  acquire(&shmtable.lock);
+  for(sh = shmtable.shm; sh < &shmtable.shm[NSHM]; sh++){
+    if(sh->npages > 0 && strncmp(sh->name, name, SHMNAME) == 0){
+      sh->name[0] = 0;
+      shmfree(sh);
+      release(&shmtable.lock);
+      return 0;
+    }
+  }
+  release(&shmtable.lock);
+  return -1;
+}
+
+// Return the page holding byte off of sh, allocating and
+// zeroing it if this is its first use, with a reference taken
+// for the caller's PTE. Returns 0 if off is past the end of the
+// segment or memory is exhausted.
+uint64
+shmpage(struct shm *sh, uint off)
+{
+  uint64 pa;
+  int i = off / PGSIZE;
+
+  acquire(&shmtable.lock);
+  if(i >= sh->npages){
+    release(&shmtable.lock);
+    return 0;
+  }
+  if(sh->page[i] == 0){
+    if((pa = (uint64)kalloc()) == 0){
+      release(&shmtable.lock);
+      return 0;
+    }
+    memset((void*)pa, 0, PGSIZE);
+    sh->page[i] = pa;
+  }
+  pa = sh->page[i];
+  krefinc((void*)pa);
+  release(&shmtable.lock);
+  return pa;
+}
+
+// Back all of sh, a new segment, with one physically contiguous
+// block of zeroed pages, so that the kernel can use the segment
+// as a single structure (a uring, say) at the address returned.
+// Returns 0 if out of memory.
+void*
+shmcontig(struct shm *sh)
+{
+  char *mem;
+  int order = 0, i;
+
+  while((1 << order) < sh->npages)
+    order++;
+  if((mem = kallocorder(order)) == 0)
+    return 0;
+  memset(mem, 0, (uint64)PGSIZE << order);
+  acquire(&shmtable.lock);
+  for(i = 0; i < (1 << order); i++){
+    if(i < sh->npages)
+      sh->page[i] = (uint64)mem + (uint64)i*PGSIZE;
+    else
+      kfree(mem + (uint64)i*PGSIZE);
+  }
+  release(&shmtable.lock);
+  return mem;
+}
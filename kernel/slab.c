@@ -0,0 +1,270 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one size, such as struct pipe or
+// struct file, carved from slabs: blocks of 2^order pages from
+// kallocorder(). A slab starts with a struct slab header, and
+// its free objects are linked through their first word. Since a
+// block is aligned to its size, the slab holding an object is
+// found by rounding the object's address down.
+//
+// Each CPU keeps a magazine of free objects per cache, so that
+// most kcachealloc() and kcachefree() calls touch only their own
+// CPU's magazine, with interrupts off, and take no lock. An empty
+// magazine is refilled from the slabs, and a full one gives half
+// its objects back, under the cache's lock. A slab whose objects
+// are all free is returned to the page allocator, except for one
+// kept in reserve.
+//
+// Interface:
+// * kcachecreate() makes a cache for objects of a given size.
+// * kcachealloc() returns an object; its contents are junk.
+// * kcachefree() gives an object back to its cache.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "slabstat.h"
+#include "defs.h"
+
+#define NKCACHE  8    // maximum number of caches
+#define MAGSIZE  16   // objects in a per-CPU magazine
+#define SLABMAXORDER 2
+
+struct slab {
+  struct slab *next;  // in the cache's partial or full list
+  struct slab *prev;
+  void *free;         // free objects, linked through their first word
+  int inuse;          // objects handed out, or in magazines
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+  uint64 nalloc;      // kcachealloc() calls on this CPU
+};
+
+struct kcache {
+  struct spinlock lock;
+  struct slab partial;  // slabs with free objects, circular
+  struct slab full;     // slabs with none, circular
+  int nempty;           // slabs on partial with no objects in use
+  struct slabstat st;
+  struct magazine mag[NCPU];
+};
+
+static struct kcache caches[NKCACHE];
+static int ncaches;
+static struct spinlock cachelock;  // protects ncaches
+
+// Caller must hold c->lock.
+static void
+slabmove(struct slab *s, struct slab *head)
+{
+  s->next->prev = s->prev;
+  s->prev->next = s->next;
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+// Make a cache for objects of size bytes, named name for
+// slabstat(). Panics if there are too many caches, or if
+// size is too big for a slab.
+struct kcache*
+kcachecreate(char *name, int size)
+{
+  struct kcache *c;
+  int order, n;
+
+  acquire(&cachelock);
+  if(ncaches == NKCACHE)
+    panic("kcachecreate: too many caches");
+  c = &caches[ncaches++];
+  release(&cachelock);
+
+  initlock(&c->lock, "kcache");
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  safestrcpy(c->st.name, name, SLABNAME);
+  c->st.size = (size + 7) & ~7;
+
+  // the smallest slab that wastes no more than 1/8 of itself.
+  for(order = 0; ; order++){
+    n = ((PGSIZE << order) - sizeof(struct slab)) / c->st.size;
+    if(order == SLABMAXORDER || n * c->st.size >= (PGSIZE << order) * 7 / 8)
+      break;
+  }
+  if(n == 0)
+    panic("kcachecreate: object too big");
+  c->st.order = order;
+  c->st.perslab = n;
+  return c;
+}
+
+// Allocate a new slab for c and put it on the partial list.
+// Caller must hold c->lock. Returns 0 if out of memory.
+static struct slab*
+slabgrow(struct kcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = kallocorder(c->st.order)) == 0)
+    return 0;
+  s->inuse = 0;
+  s->free = 0;
+  o = (char*)(s + 1) + (uint64)(c->st.perslab - 1) * c->st.size;
+  for(i = 0; i < c->st.perslab; i++, o -= c->st.size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+  c->nempty++;
+  c->st.nslab++;
+  return s;
+}
+
+// Move up to n objects from c's slabs into magazine m.
+// Caller must hold c->lock.
+static void
+refill(struct kcache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+
+  while(m->n < n){
+    if((s = c->partial.next) == &c->partial && (s = slabgrow(c)) == 0)
+      break;
+    if(s->inuse == 0)
+      c->nempty--;
+    while(m->n < n && s->free){
+      m->obj[m->n++] = s->free;
+      s->free = *(void**)s->free;
+      s->inuse++;
+      c->st.ninuse++;
+    }
+    if(s->free == 0)
+      slabmove(s, &c->full);
+  }
+}
+
+// Give object o back to its slab, freeing the slab if all its
+// objects are free and another empty slab is already kept.
+// Caller must hold c->lock.
+static void
+slabfree(struct kcache *c, void *o)
+{
+  struct slab *s;
+  int i;
+
+  s = (struct slab*)((uint64)o & ~(((uint64)PGSIZE << c->st.order) - 1));
+  if(s->free == 0)
+    slabmove(s, &c->partial);
+  *(void**)o = s->free;
+  s->free = o;
+  s->inuse--;
+  c->st.ninuse--;
+  if(s->inuse > 0)
+    return;
+  if(c->nempty == 0){
+    c->nempty++;
+    return;
+  }
+  s->next->prev = s->prev;
+  s->prev->next = s->next;
+  c->st.nslab--;
+  for(i = 0; i < (1 << c->st.order); i++)
+    kfree((char*)s + (uint64)PGSIZE * i);
+}
+
+// Return an object from cache c. Its contents are junk.
+// Returns 0 if out of memory.
+void*
+kcachealloc(struct kcache *c)
+{
+  struct magazine *m;
+  void *o = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    refill(c, m, MAGSIZE / 2);
+    c->st.nrefill++;
+    release(&c->lock);
+  }
+  if(m->n > 0){
+    o = m->obj[--m->n];
+    m->nalloc++;
+  }
+  pop_off();
+  return o;
+}
+
+// Give object o, from kcachealloc(c), back to cache c.
+void
+kcachefree(struct kcache *c, void *o)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slabfree(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  pop_off();
+}
+
+void
+slabinit(void)
+{
+  initlock(&cachelock, "kcaches");
+}
+
+// Copy up to n caches' statistics to the user array at addr.
+// Returns the number copied, or -1.
+int
+slabstat(uint64 addr, int n)
+{
+  struct kcache *c;
+  struct slabstat s;
+  int i, j;
+
+  if(n < 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    acquire(&cachelock);
+    if(i >= ncaches){
+      release(&cachelock);
+      break;
+    }
+    c = &caches[i];
+    release(&cachelock);
+    acquire(&c->lock);
+    s = c->st;
+    release(&c->lock);
+    // other CPUs' magazines change without the lock; this is
+    // only a snapshot.
+    s.nmag = 0;
+    s.nalloc = 0;
+    for(j = 0; j < NCPU; j++){
+      s.nmag += c->mag[j].n;
+      s.nalloc += c->mag[j].nalloc;
+    }
+    if(copyout(myproc()->pagetable, addr + i*sizeof(s), (char*)&s, sizeof(s)) < 0)
+      return -1;
+  }
+  return i;
+}
@@ -0,0 +1,17 @@
+// Slab allocator statistics, read by slabstat().
+// Both the kernel and user programs use this header file.
+// There is one entry per object cache (pipes, files, ...).
+
+#define SLABNAME 16
+
+struct slabstat {
+  char name[SLABNAME];
+  int size;             // object size in bytes, rounded up
+  int order;            // each slab is 2^order pages
+  int perslab;          // objects per slab
+  uint64 nslab;         // slabs allocated now
+  uint64 ninuse;        // objects out of the slabs, including magazines
+  uint64 nmag;          // of those, objects waiting in per-CPU magazines
+  uint64 nalloc;        // kcachealloc() calls
+  uint64 nrefill;       // calls that had to refill their CPU's magazine
+};
@@ -6,27 +6,55 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "lockstat.h"
+
+// Counters shared by the spinlocks inside all sleep locks.
+static struct lockstat *innerstat;
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  initsleeplockstat(lk, name, lockregister(name, LOCK_SLEEP));
+}
+
+// Like initlockstat(), for a sleep lock. The inner spinlock is
+// registered only the first time.
+void
+initsleeplockstat(struct sleeplock *lk, char *name, struct lockstat *st)
+{
+  struct lockstat *inner;
+
+  if((inner = __atomic_load_n(&innerstat, __ATOMIC_ACQUIRE)) == 0){
+    inner = lockregister("sleep lock", LOCK_SPIN);
+    __atomic_store_n(&innerstat, inner, __ATOMIC_RELEASE);
+  }
+  initlockstat(&lk->lk, "sleep lock", inner);
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->stat = st;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  if(lk->locked){
+    uint64 start = r_time();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
+    lockcontended(lk->stat, start);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  if(lk->stat){
+    __atomic_fetch_add(&lk->stat->nacquire, 1, __ATOMIC_RELAXED);
+    lk->tacquire = r_time();
+  }
   release(&lk->lk);
 }
 
@@ -34,6 +62,8 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->stat)
+    lockhold(lk->stat, r_time() - lk->tacquire);
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
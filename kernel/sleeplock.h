@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For lockstat():
+  struct lockstat *stat; // Shared counters for locks of this name, or 0.
+  uint64 tacquire;       // time CSR value when acquired.
 };
 
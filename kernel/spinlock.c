@@ -5,15 +5,44 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "rusage.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initlockstat(lk, name, lockregister(name, LOCK_SPIN));
+}
+
+// Initialize lk to count under st, which lockregister() returned
+// for name. The locks in objects that a kcache hands out over
+// and over (pipes, say) register their name once, when the cache
+// is made, and use this, rather than take statlock and count
+// another lock each time an object is allocated.
+void
+initlockstat(struct spinlock *lk, char *name, struct lockstat *st)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->ticket = 0;
+  lk->stat = st;
+}
+
+// A ticket lock grants the lock in arrival order, and waiters
+// only read lk->serving while they spin instead of all doing
+// amoswaps on lk->locked, so it degrades more gracefully than
+// the test-and-set lock when many harts want the same lock.
+// It is otherwise used just like any other spinlock.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->ticket = 1;
+  lk->next = 0;
+  lk->serving = 0;
 }
 
 // Acquire the lock.
@@ -25,12 +54,28 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // Only time the spin if the lock isn't free on the first try.
+  if(lk->ticket){
+    // Take a ticket (an amoadd.w on RISC-V) and wait for it
+    // to be served.
+    uint me = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != me){
+      uint64 start = r_time();
+      while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != me)
+        ;
+      lockcontended(lk->stat, start);
+    }
+    lk->locked = 1;
+  } else if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    uint64 start = r_time();
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      ;
+    lockcontended(lk->stat, start);
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +85,10 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  if(lk->stat){
+    __atomic_fetch_add(&lk->stat->nacquire, 1, __ATOMIC_RELAXED);
+    lk->tacquire = r_time();
+  }
 }
 
 // Release the lock.
@@ -49,6 +98,8 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->stat)
+    lockhold(lk->stat, r_time() - lk->tacquire);
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -66,7 +117,13 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->ticket){
+    // hand the lock to the next ticket holder.
+    lk->locked = 0;
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+  } else {
+    __sync_lock_release(&lk->locked);
+  }
 
   pop_off();
 }
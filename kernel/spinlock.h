@@ -2,7 +2,16 @@
 struct spinlock {
   uint locked;       // Is the lock held?
 
+  // Ticket (FIFO) locks, see initticketlock():
+  uint ticket;       // Is this a ticket lock?
+  uint next;         // Next ticket to hand out.
+  uint serving;      // Ticket now allowed to hold the lock.
+
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  struct lockstat *stat; // Shared counters for locks of this name, or 0.
+  uint64 tacquire;       // time CSR value when acquired.
 };
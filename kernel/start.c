@@ -6,10 +6,17 @@
 
 void main();
 void timerinit();
+void ipiinit();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// a scratch area per CPU for machine-mode IPI handling.
+uint64 ipi_scratch[NCPU][3];
+
+// in kernelvec.S, for machine-mode software interrupts.
+extern void mswivec();
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -40,6 +47,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let other harts wake this one with an IPI.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -64,3 +74,28 @@ timerinit()
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
 }
+
+// arrange to receive inter-processor interrupts, which
+// scheduler() uses to wake harts parked in wfi.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  // prepare information in scratch[] for mswivec.
+  // scratch[0..1] : space for mswivec to save registers.
+  // scratch[2] : address of this hart's CLINT msip word.
+  uint64 *scratch = &ipi_scratch[id][0];
+  scratch[2] = CLINT_MSIP(id);
+  w_mscratch((uint64)scratch);
+
+  // set the machine-mode trap handler.
+  w_mtvec((uint64)mswivec);
+
+  // enable machine-mode software interrupts. they are always
+  // taken while the hart runs in supervisor or user mode.
+  w_mie(r_mie() | MIE_MSIE);
+
+  // mswivec turns them into supervisor software interrupts.
+  w_sie(r_sie() | SIE_SSIE);
+}
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -13,7 +14,8 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  uint64 sz = p->leader->sz;
+  if(addr >= sz || addr+sizeof(uint64) > sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -112,6 +114,34 @@ extern uint64 sys_setnice(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
 extern uint64 sys_freemem(void);
+extern uint64 sys_cpuidle(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_setquantum(void);
+extern uint64 sys_wait3(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_lockbench(void);
+extern uint64 sys_pipesize(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_tee(void);
+extern uint64 sys_copy_file_range(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_uring_enter(void);
+extern uint64 sys_msync(void);
+extern uint64 sys_shm_open(void);
+extern uint64 sys_shm_unlink(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_kmemstat(void);
+extern uint64 sys_kmemstress(void);
+extern uint64 sys_slabstat(void);
+extern uint64 sys_uring_setup(void);
 
 
 
@@ -149,6 +179,34 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mmap]   sys_mmap,
 [SYS_munmap] sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_cpuidle] sys_cpuidle,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_setquantum] sys_setquantum,
+[SYS_wait3]   sys_wait3,
+[SYS_getrusage] sys_getrusage,
+[SYS_profctl] sys_profctl,
+[SYS_profread] sys_profread,
+[SYS_lockstat] sys_lockstat,
+[SYS_lockbench] sys_lockbench,
+[SYS_pipesize] sys_pipesize,
+[SYS_splice] sys_splice,
+[SYS_tee]     sys_tee,
+[SYS_copy_file_range] sys_copy_file_range,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_uring_enter] sys_uring_enter,
+[SYS_msync]  sys_msync,
+[SYS_shm_open] sys_shm_open,
+[SYS_shm_unlink] sys_shm_unlink,
+[SYS_clone]  sys_clone,
+[SYS_join]   sys_join,
+[SYS_futex]  sys_futex,
+[SYS_kmemstat] sys_kmemstat,
+[SYS_kmemstress] sys_kmemstress,
+[SYS_slabstat] sys_slabstat,
+[SYS_uring_setup] sys_uring_setup,
 
 
 };
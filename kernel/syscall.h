@@ -30,5 +30,33 @@
 #define SYS_mmap   29
 #define SYS_munmap 30
 #define SYS_freemem  31
+#define SYS_cpuidle  32
+#define SYS_nanosleep 33
+#define SYS_setquantum 34
+#define SYS_wait3  35
+#define SYS_getrusage 36
+#define SYS_profctl 37
+#define SYS_profread 38
+#define SYS_lockstat 39
+#define SYS_lockbench 40
+#define SYS_pipesize 41
+#define SYS_splice 42
+#define SYS_tee    43
+#define SYS_copy_file_range 44
+#define SYS_readv  45
+#define SYS_writev 46
+#define SYS_pread  47
+#define SYS_pwrite 48
+#define SYS_uring_enter 49
+#define SYS_msync  50
+#define SYS_shm_open 51
+#define SYS_shm_unlink 52
+#define SYS_clone  53
+#define SYS_join   54
+#define SYS_futex  55
+#define SYS_kmemstat 56
+#define SYS_kmemstress 57
+#define SYS_slabstat 58
+#define SYS_uring_setup 59
 
 
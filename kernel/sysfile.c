@@ -10,47 +10,95 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "uring.h"
+#include "mman.h"
+
+// Return the struct file for descriptor fd of the current process,
+// with a reference that the caller must drop with fileclose(): a
+// sibling thread may close fd meanwhile.
+int
+fdfile(int fd, struct file **pf)
+{
+  struct proc *p = myproc()->leader;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&p->fdlock);
+  if((f = p->ofile[fd]) == 0){
+    release(&p->fdlock);
+    return -1;
+  }
+  *pf = filedup(f);
+  release(&p->fdlock);
+  return 0;
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return both the descriptor and the corresponding struct file,
+// referenced as fdfile() does.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
-  struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fdfile(fd, pf) < 0)
     return -1;
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
+// f must be ready for use: other threads can see it at once.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->leader;
 
+  acquire(&p->fdlock);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      release(&p->fdlock);
       return fd;
     }
   }
+  release(&p->fdlock);
   return -1;
 }
 
+// Free descriptor fd and return its file, whose reference
+// passes to the caller, or 0 if fd isn't open. If f isn't 0,
+// only free fd if it still refers to f.
+static struct file*
+fdfree(int fd, struct file *f)
+{
+  struct proc *p = myproc()->leader;
+  struct file *of;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&p->fdlock);
+  of = p->ofile[fd];
+  if(f && of != f)
+    of = 0;
+  if(of)
+    p->ofile[fd] = 0;
+  release(&p->fdlock);
+  return of;
+}
+
 uint64
 sys_dup(void)
 {
@@ -59,9 +107,10 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -71,12 +120,15 @@ sys_read(void)
   struct file *f;
   int n;
   uint64 p;
+  int r;
 
   argaddr(1, &p);
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, 1, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
@@ -85,38 +137,51 @@ sys_write(void)
   struct file *f;
   int n;
   uint64 p;
+  int r;
   
   argaddr(1, &p);
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, 1, p, n);
+  fileclose(f);
+  return r;
 }
 
-uint64
-sys_close(void)
+static int
+fdclose(int fd)
 {
-  int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if((f = fdfree(fd, 0)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
 
+uint64
+sys_close(void)
+{
+  int fd;
+
+  argint(0, &fd);
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
   argaddr(1, &st);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -301,18 +366,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode and return a new descriptor for it.
+static int
+openpath(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -341,9 +401,7 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -360,6 +418,14 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
+  if((fd = fdalloc(f)) < 0){
+    f->type = FD_NONE;  // ip is still locked; put it here
+    fileclose(f);
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -370,6 +436,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -410,8 +488,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct proc *p = myproc()->leader;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +503,12 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
-  end_op();
+  acquire(&p->fdlock);
+  old = p->cwd;
   p->cwd = ip;
+  release(&p->fdlock);
+  iput(old);
+  end_op();
   return 0;
 }
 
@@ -474,32 +555,379 @@ sys_exec(void)
   return -1;
 }
 
-uint64
-sys_pipe(void)
+// Make a pipe and store its two descriptors in the user
+// array at fdarray.
+static int
+pipefds(uint64 fdarray)
 {
-  uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
   struct proc *p = myproc();
 
-  argaddr(0, &fdarray);
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+    if(fd0 < 0 || fdfree(fd0, rf))
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    // a sibling thread may have closed fd0 or fd1 already.
+    if(fdfree(fd0, rf))
+      fileclose(rf);
+    if(fdfree(fd1, wf))
+      fileclose(wf);
+    return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_pipe(void)
+{
+  uint64 fdarray; // user pointer to array of two integers
+
+  argaddr(0, &fdarray);
+  return pipefds(fdarray);
+}
+
+// pipesize(int fd, int size): resize the pipe fd refers to.
+uint64
+sys_pipesize(void)
+{
+  struct file *f;
+  int size, r;
+
+  argint(1, &size);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = f->type == FD_PIPE ? pipesize(f->pipe, size) : -1;
+  fileclose(f);
+  return r;
+}
+
+// shm_open(char *name, int size, int omode): open the shared
+// memory segment name, creating it with size bytes if omode has
+// O_CREATE, and return a file descriptor for mmap().
+uint64
+sys_shm_open(void)
+{
+  char name[MAXPATH];
+  int size, omode, fd;
+  struct file *f;
+
+  argint(1, &size);
+  argint(2, &omode);
+  if(argstr(0, name, MAXPATH) < 0 || name[0] == 0)
+    return -1;
+  if((f = shmopen(name, size, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// shm_unlink(char *name): remove the name of a shared memory
+// segment.
+uint64
+sys_shm_unlink(void)
+{
+  char name[MAXPATH];
+
+  if(argstr(0, name, MAXPATH) < 0)
+    return -1;
+  return shmunlink(name);
+}
+
+// splice(int fdin, int fdout, int n): move up to n bytes from
+// fdin to fdout without copying them to user space. One of the
+// two must be a pipe.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0)
+    return -1;
+  if(argfd(1, 0, &out) < 0){
+    fileclose(in);
+    return -1;
+  }
+  r = filesplice(in, out, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+// tee(int fdin, int fdout, int n): copy up to n bytes from
+// pipe fdin to pipe fdout without consuming them.
+uint64
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0)
+    return -1;
+  if(argfd(1, 0, &out) < 0){
+    fileclose(in);
     return -1;
   }
+  r = filetee(in, out, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+// Fetch the iovec array argument: n entries at user address
+// addr. Rejects counts over IOV_MAX and lengths that don't fit
+// in an int.
+static int
+argiov(uint64 addr, int n, struct iovec *iov)
+{
+  uint64 total = 0;
+
+  if(n < 0 || n > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, n*sizeof(struct iovec)) < 0)
+    return -1;
+  for(int i = 0; i < n; i++){
+    total += iov[i].iov_len;
+    if(iov[i].iov_len > 0x7fffffff || total > 0x7fffffff)
+      return -1;
+  }
   return 0;
 }
+
+// readv(int fd, struct iovec *iov, int iovcnt)
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  uint64 uiov;
+  int n, r;
+
+  argaddr(1, &uiov);
+  argint(2, &n);
+  if(argiov(uiov, n, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filereadv(f, iov, n);
+  fileclose(f);
+  return r;
+}
+
+// writev(int fd, struct iovec *iov, int iovcnt)
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  uint64 uiov;
+  int n, r;
+
+  argaddr(1, &uiov);
+  argint(2, &n);
+  if(argiov(uiov, n, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filewritev(f, iov, n);
+  fileclose(f);
+  return r;
+}
+
+// pread(int fd, void *buf, int n, int off)
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  uint64 p;
+  int n, off, r;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(n < 0 || off < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepread(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+// pwrite(int fd, void *buf, int n, int off)
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  uint64 p;
+  int n, off, r;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(n < 0 || off < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepwrite(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+// copy_file_range(int fdin, int fdout, int n): copy up to n
+// bytes from file fdin to file or device fdout inside the
+// kernel, advancing both offsets.
+uint64
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0)
+    return -1;
+  if(argfd(1, 0, &out) < 0){
+    fileclose(in);
+    return -1;
+  }
+  r = filecopy(in, out, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+// Run one queued uring operation and return its result.
+static int
+uringop(struct uring_sqe *e)
+{
+  struct file *f;
+  char path[MAXPATH];
+  int r;
+
+  switch(e->op){
+  case URING_NOP:
+    return 0;
+  case URING_READ:
+    if(fdfile(e->fd, &f) < 0)
+      return -1;
+    r = fileread(f, 1, e->addr, e->len);
+    fileclose(f);
+    return r;
+  case URING_WRITE:
+    if(fdfile(e->fd, &f) < 0)
+      return -1;
+    r = filewrite(f, 1, e->addr, e->len);
+    fileclose(f);
+    return r;
+  case URING_OPEN:
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, e->flags);
+  case URING_CLOSE:
+    return fdclose(e->fd);
+  case URING_FSTAT:
+    if(fdfile(e->fd, &f) < 0)
+      return -1;
+    r = filestat(f, e->addr);
+    fileclose(f);
+    return r;
+  case URING_PIPE:
+    return pipefds(e->addr);
+  }
+  return -1;
+}
+
+// uring_setup(): make a ring shared between the process and
+// the kernel, a shared memory segment mapped in the process, and
+// return its address in the process. A process has at most one
+// ring; fork() shares it with the child. Returns -1 on error.
+uint64
+sys_uring_setup(void)
+{
+  struct proc *p = myproc()->leader;
+  struct file *f;
+  struct uring *ring;
+  uint64 va, len = PGROUNDUP(sizeof(struct uring));
+
+  if(p->uringf)
+    return -1;
+  if((f = shmopen("", len, O_RDWR)) == 0)
+    return -1;
+  if((ring = shmcontig(f->shm)) == 0){
+    fileclose(f);
+    return -1;
+  }
+  // the mapping takes one reference to the segment, and the
+  // process keeps another, so the ring outlives a munmap().
+  filedup(f);
+  if((va = mmapfile(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, f, 0)) == -1){
+    fileclose(f);
+    return -1;
+  }
+  p->uringf = f;
+  p->uring = ring;
+  p->uringva = va;
+  return va;
+}
+
+// Drop p's ring, for exit and exec.
+void
+uringclose(struct proc *p)
+{
+  if(p->uringf)
+    fileclose(p->uringf);
+  p->uringf = 0;
+  p->uring = 0;
+  p->uringva = 0;
+}
+
+// uring_enter(struct uring *r, int n): run up to n queued
+// operations from the ring at r, which uring_setup() returned,
+// in order, posting a completion for each. The kernel reads and
+// writes the ring in place. Stops early if the completion queue
+// fills up. Returns the number of operations run.
+uint64
+sys_uring_enter(void)
+{
+  struct proc *p = myproc();
+  struct uring *ring = p->leader->uring;
+  struct uring_sqe e;
+  struct uring_cqe *c;
+  uint64 r;
+  uint head, tail, cqtail;
+  int n, done;
+
+  argaddr(0, &r);
+  argint(1, &n);
+  if(ring == 0 || r != p->leader->uringva)
+    return -1;
+
+  // the program writes sq_tail and cq_head while this runs;
+  // load them once per step, and copy each entry before using
+  // it, so that it can't change under the operation.
+  head = ring->sq_head;
+  cqtail = ring->cq_tail;
+  for(done = 0; done < n; done++){
+    tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    if(head == tail || killed(p))
+      break;
+    if(cqtail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= URING_ENTRIES)
+      break;
+    e = ring->sq[head % URING_ENTRIES];
+    c = &ring->cq[cqtail % URING_ENTRIES];
+    c->user_data = e.user_data;
+    c->res = uringop(&e);
+    c->pad = 0;
+    head++;
+    cqtail++;
+    // publish each completion as it is posted.
+    __atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->cq_tail, cqtail, __ATOMIC_RELEASE);
+  }
+  return done;
+}
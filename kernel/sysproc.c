@@ -4,6 +4,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
 
@@ -20,10 +21,13 @@ sys_exit(void)
   return 0;  // not reached
 }
 
+// Every thread of a process gets the process's pid, the same
+// as ugetpid() reads from the USYSCALL page the threads share.
+// A thread's own id is what clone() returned.
 uint64
 sys_getpid(void)
 {
-  return myproc()->pid;
+  return myproc()->leader->pid;
 }
 
 uint64
@@ -47,11 +51,13 @@ sys_sbrk(void)
   int t;
   int n;
 
+  struct proc *p = myproc()->leader;
+
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
 
   if(t == SBRK_EAGER || n < 0) {
+    addr = p->sz;
     if(growproc(n) < 0) {
       return -1;
     }
@@ -59,9 +65,14 @@ sys_sbrk(void)
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
+    acquire(&p->vmlock);
+    addr = p->sz;
+    if(addr + n < addr || addr + n > p->mmap_next){
+      release(&p->vmlock);
       return -1;
-    myproc()->sz += n;
+    }
+    p->sz += n;
+    release(&p->vmlock);
   }
   return addr;
 }
@@ -70,22 +81,42 @@ uint64
 sys_pause(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
+  return timersleep(r_time() + (uint64)n * TICKCYCLES);
+}
+
+// nanosleep(uint64 nsec): sleep for nsec nanoseconds, rounded
+// up to the resolution of the time CSR.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+  uint64 cycles;
+
+  argaddr(0, &ns);
+  cycles = (ns * (TIMEBASE / 1000000) + 999) / 1000;
+  return timersleep(r_time() + cycles);
+}
+
+// setquantum(int usec): set the scheduling time slice, in
+// microseconds. usec <= 0 leaves it alone.
+// returns the previous time slice.
+uint64
+sys_setquantum(void)
+{
+  int usec;
+  uint64 old = quantum / (TIMEBASE / 1000000);
+
+  argint(0, &usec);
+  if(usec > 0){
+    if(usec < 100 || usec > 10000000)
       return -1;
-    }
-    sleep(&ticks, &tickslock);
+    quantum = (uint64)usec * (TIMEBASE / 1000000);
   }
-  release(&tickslock);
-  return 0;
+  return old;
 }
 
 uint64
@@ -127,12 +158,7 @@ sys_reboot(void)
 uint64
 sys_rtcgettime(void)
 {
-    volatile uint32 *rtc = (uint32 *) VIRT_RTC;
-
-    uint32 lo = rtc[0];     // low 32 bits
-    uint32 hi = rtc[1];     // high 32 bits
-
-    return ((uint64)hi << 32) | lo;
+    return rtcread();
 }
 
 uint64
@@ -158,6 +184,57 @@ sys_wait2(void)
     return wait2(ustatus, usyscalls);
 }
 
+uint64
+sys_wait3(void)
+{
+    uint64 ustatus;
+    uint64 urusage;
+
+    argaddr(0, &ustatus);
+    argaddr(1, &urusage);
+
+    return kwait3(ustatus, urusage);
+}
+
+// getrusage(int who, struct rusage *ru)
+uint64
+sys_getrusage(void)
+{
+    int who;
+    uint64 ru;
+
+    argint(0, &who);
+    argaddr(1, &ru);
+
+    return kgetrusage(who, ru);
+}
+
+// profctl(int cmd, int usec): start or stop the sampling profiler.
+uint64
+sys_profctl(void)
+{
+    int cmd;
+    int usec;
+
+    argint(0, &cmd);
+    argint(1, &usec);
+
+    return profctl(cmd, usec);
+}
+
+// profread(struct profsample *buf, int n)
+uint64
+sys_profread(void)
+{
+    uint64 buf;
+    int n;
+
+    argaddr(0, &buf);
+    argint(1, &n);
+
+    return profread(buf, n);
+}
+
 uint64
 sys_getcwd(void)
 {
@@ -227,8 +304,136 @@ sys_munmap(void)
     return kmunmap(addr, length);
 }
 
+uint64
+sys_msync(void)
+{
+    uint64 addr;
+    int length;
+
+    argaddr(0, &addr);
+    argint(1, &length);
+
+    return kmsync(addr, length);
+}
+
 uint64
 sys_freemem(void)
 {
     return freemem();
 }
+
+// cpuidle(uint64 *idle, int n): per-hart time spent idle in wfi.
+uint64
+sys_cpuidle(void)
+{
+    uint64 idle;
+    int n;
+
+    argaddr(0, &idle);
+    argint(1, &n);
+
+    return cpuidle(idle, n);
+}
+
+// lockstat(struct lockstat *buf, int n)
+uint64
+sys_lockstat(void)
+{
+    uint64 buf;
+    int n;
+
+    argaddr(0, &buf);
+    argint(1, &n);
+
+    return lockstat(buf, n);
+}
+
+// lockbench(int kind, int n, struct lockbench *r)
+uint64
+sys_lockbench(void)
+{
+    int kind, n;
+    uint64 r;
+
+    argint(0, &kind);
+    argint(1, &n);
+    argaddr(2, &r);
+
+    return lockbench(kind, n, r);
+}
+
+// clone(void (*fn)(void*), void *arg, void *stack)
+uint64
+sys_clone(void)
+{
+    uint64 fn, arg, stack;
+
+    argaddr(0, &fn);
+    argaddr(1, &arg);
+    argaddr(2, &stack);
+
+    return kclone(fn, arg, stack);
+}
+
+// join(int tid, int *status)
+uint64
+sys_join(void)
+{
+    int tid;
+    uint64 status;
+
+    argint(0, &tid);
+    argaddr(1, &status);
+
+    return kjoin(tid, status);
+}
+
+// futex(int *addr, int op, int val)
+uint64
+sys_futex(void)
+{
+    uint64 addr;
+    int op, val;
+
+    argaddr(0, &addr);
+    argint(1, &op);
+    argint(2, &val);
+
+    return kfutex(addr, op, val);
+}
+
+// kmemstat(struct kmemstat *st)
+uint64
+sys_kmemstat(void)
+{
+    uint64 st;
+
+    argaddr(0, &st);
+
+    return kmemstat(st);
+}
+
+// kmemstress(int n, int seed)
+uint64
+sys_kmemstress(void)
+{
+    int n, seed;
+
+    argint(0, &n);
+    argint(1, &seed);
+
+    return kmemstress(n, seed);
+}
+
+// slabstat(struct slabstat *buf, int n)
+uint64
+sys_slabstat(void)
+{
+    uint64 buf;
+    int n;
+
+    argaddr(0, &buf);
+    argint(1, &n);
+
+    return slabstat(buf, n);
+}
@@ -0,0 +1,153 @@
+// One-shot timers.
+//
+// Each CPU keeps a queue of armed timers sorted by absolute
+// deadline (a time CSR value). stimecmp is always programmed
+// for the earliest thing the CPU needs: the head of its timer
+// queue, the end of the running process's time slice, and, on
+// hart 0, the next clock tick. Nothing else causes a timer
+// interrupt, so an idle hart with no timers sleeps until an
+// IPI or device interrupt, and a sleeping process is woken
+// exactly once, when its own deadline passes.
+//
+// Interface:
+// * timersleep(deadline) puts the current process to sleep
+//   until the time CSR reaches deadline.
+// * clockintr() calls timerexpire() to wake the sleepers whose
+//   deadlines have passed, then timernext() to find when to
+//   interrupt next.
+//
+// A timer always goes on the queue of the CPU that armed it,
+// so that CPU can lower its own stimecmp right away. It may be
+// cancelled from any CPU, which at worst leaves a spurious
+// interrupt behind.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+struct timerq {
+  struct spinlock lock;
+  struct timer *head;   // sorted by deadline, earliest first.
+};
+
+struct timerq timerq[NCPU];
+
+// time slice given to a process each time it is scheduled,
+// in time CSR cycles. see setquantum().
+uint64 quantum = QUANTUM;
+
+void
+timerqinit(void)
+{
+  for(struct timerq *q = timerq; q < &timerq[NCPU]; q++)
+    initlock(&q->lock, "timerq");
+}
+
+// Insert t into q in deadline order.
+// Caller must hold q->lock.
+static void
+timerinsert(struct timerq *q, struct timer *t)
+{
+  struct timer **pp;
+
+  for(pp = &q->head; *pp && (*pp)->deadline <= t->deadline; pp = &(*pp)->next)
+    ;
+  t->next = *pp;
+  *pp = t;
+  t->cpu = q - timerq;
+}
+
+// Remove t from q, if it is still there.
+// Caller must hold q->lock.
+static void
+timerremove(struct timerq *q, struct timer *t)
+{
+  struct timer **pp;
+
+  for(pp = &q->head; *pp; pp = &(*pp)->next){
+    if(*pp == t){
+      *pp = t->next;
+      break;
+    }
+  }
+  t->next = 0;
+  t->cpu = -1;
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns 0, or -1 if the process was killed while asleep.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+  struct timer *t = &p->timer;
+  struct timerq *q;
+
+  if(deadline <= r_time())
+    return 0;
+
+  // pick this CPU's queue without moving to another
+  // CPU in between; acquire() then keeps interrupts off.
+  push_off();
+  q = &timerq[cpuid()];
+  acquire(&q->lock);
+  pop_off();
+
+  t->deadline = deadline;
+  timerinsert(q, t);
+
+  // we're still on the CPU that owns q, so we can bring
+  // its next timer interrupt forward ourselves.
+  if(deadline < r_stimecmp())
+    w_stimecmp(deadline);
+
+  // timerexpire() takes t off the queue before waking us,
+  // holding q->lock, so the wakeup can't be missed.
+  while(t->cpu >= 0){
+    if(killed(p)){
+      timerremove(q, t);
+      release(&q->lock);
+      return -1;
+    }
+    sleep(t, &q->lock);
+  }
+  release(&q->lock);
+  return 0;
+}
+
+// Wake the processes sleeping on this CPU's timers whose
+// deadlines have passed. Called by clockintr().
+void
+timerexpire(uint64 now)
+{
+  struct timerq *q = &timerq[cpuid()];
+  struct timer *t;
+
+  acquire(&q->lock);
+  while((t = q->head) != 0 && t->deadline <= now){
+    q->head = t->next;
+    t->next = 0;
+    t->cpu = -1;
+    wakeup(t);
+  }
+  release(&q->lock);
+}
+
+// The deadline of this CPU's earliest timer, or ~0 if none.
+uint64
+timernext(void)
+{
+  struct timerq *q = &timerq[cpuid()];
+  uint64 next = ~0UL;
+
+  acquire(&q->lock);
+  if(q->head)
+    next = q->head->deadline;
+  release(&q->lock);
+  return next;
+}
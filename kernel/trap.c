@@ -3,11 +3,14 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "vdata.h"
 #include "defs.h"
 
 struct spinlock tickslock;
 uint ticks;
+uint64 nexttick;   // time CSR value of hart 0's next clock tick.
 
 extern char trampoline[], uservec[];
 
@@ -27,6 +30,9 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+  // let user code read the time CSR (rdtime), for the clock
+  // in the VDATA page.
+  w_scounteren(r_scounteren() | 2);
 }
 
 //
@@ -46,7 +52,18 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // this hart no longer uses p's TLB entries.
+  struct cpu *c = mycpu();
+  c->ntrap++;
+  c->inuser = 0;
+
   struct proc *p = myproc();
+
+  // charge the time since we last returned to user space
+  // as user time.
+  uint64 now = r_time();
+  p->ru.utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -116,6 +133,7 @@ prepare_return(void)
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  w_sscratch(THREADFRAME(p->tslot));            // for uservec and userret
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
@@ -128,6 +146,16 @@ prepare_return(void)
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
+
+  // from here on, p's time counts as user time.
+  uint64 now = r_time();
+  p->ru.stime += now - p->tstamp;
+  p->tstamp = now;
+
+  // publish inuser before userret's sfence.vma loads p's page
+  // table; tlbshootdown() does the reverse.
+  mycpu()->inuser = 1;
+  __sync_synchronize();
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -161,25 +189,54 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
+// handle a timer interrupt: count clock ticks, fire expired
+// timers, take a profiling sample if one is due, and check
+// the running process's time slice.
+// returns 2 if the process should yield the CPU, 1 otherwise.
+int
 clockintr()
 {
-  if(cpuid() == 0){
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  uint64 next;
+  int which = 1;
+
+  if(cpuid() == 0 && now >= nexttick){
     acquire(&tickslock);
     ticks++;
-    wakeup(&ticks);
+    vdata->ticks = ticks;
     release(&tickslock);
+    nexttick += TICKCYCLES;
+    if(nexttick <= now)
+      nexttick = now + TICKCYCLES;
+  }
+
+  timerexpire(now);
+  proftick(now);
+
+  if(c->proc && now >= c->slice_end){
+    c->slice_end = now + quantum;
+    which = 2;
   }
 
   // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // the interrupt request. an idle hart without timers
+  // asks for none at all (except hart 0, for ticks).
+  next = timernext();
+  if(c->proc && c->slice_end < next)
+    next = c->slice_end;
+  if(cpuid() == 0 && nexttick < next)
+    next = nexttick;
+  if(profnext() < next)
+    next = profnext();
+  w_stimecmp(next);
+
+  return which;
 }
 
-// check if it's an external interrupt or software interrupt,
+// check if it's an external interrupt, timer interrupt, or IPI,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if timer interrupt that ended a time slice,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -210,8 +267,14 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    return clockintr();
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt: an IPI from another hart, raised by
+    // mswivec in kernelvec.S. it only exists to get us out of
+    // wfi, or out of user space for tlbshootdown(), so just
+    // acknowledge it.
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
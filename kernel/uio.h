@@ -0,0 +1,9 @@
+// Scatter/gather buffers for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+#define IOV_MAX 16   // most buffers in one readv()/writev()
+
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
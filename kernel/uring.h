@@ -0,0 +1,46 @@
+// Batched system call ring, for uring_enter().
+// Both the kernel and user programs use this header file.
+//
+// uring_setup() makes the ring, shared memory that the kernel
+// reads and writes in place. The program fills sq[] entries and
+// advances sq_tail; uring_enter() runs the queued operations in
+// order, advancing sq_head, and posts one completion per
+// operation to cq[], advancing cq_tail. The program consumes
+// completions and advances cq_head. Indexes run freely and are
+// taken modulo URING_ENTRIES. Only one uring_enter() at a time
+// may run on a ring.
+
+#define URING_ENTRIES 256   // power of two
+
+// operations
+#define URING_NOP    0
+#define URING_READ   1   // read(fd, addr, len)
+#define URING_WRITE  2   // write(fd, addr, len)
+#define URING_OPEN   3   // open((char*)addr, flags)
+#define URING_CLOSE  4   // close(fd)
+#define URING_FSTAT  5   // fstat(fd, (struct stat*)addr)
+#define URING_PIPE   6   // pipe((int*)addr)
+
+struct uring_sqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int len;
+  int flags;
+  uint64 user_data;  // copied to the completion
+};
+
+struct uring_cqe {
+  uint64 user_data;
+  int res;           // what the system call would have returned
+  int pad;
+};
+
+struct uring {
+  uint sq_head;      // written by the kernel
+  uint sq_tail;      // written by the program
+  uint cq_head;      // written by the program
+  uint cq_tail;      // written by the kernel
+  struct uring_sqe sq[URING_ENTRIES];
+  struct uring_cqe cq[URING_ENTRIES];
+};
@@ -0,0 +1,37 @@
+// Kernel-maintained data page mapped read-only at VDATA in
+// every process (see vdata.h). The clock, scheduler and idle
+// loop update it as they go; vdatainit() calibrates the time
+// CSR against the RTC once at boot so that user programs can
+// turn a time CSR reading into RTC time without a trap.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "vdata.h"
+#include "defs.h"
+
+struct vdata *vdata;
+
+// Goldfish RTC: nanoseconds since the epoch.
+uint64
+rtcread(void)
+{
+  volatile uint32 *rtc = (uint32 *) VIRT_RTC;
+
+  uint32 lo = rtc[0];     // low 32 bits; latches the high half
+  uint32 hi = rtc[1];     // high 32 bits
+
+  return ((uint64)hi << 32) | lo;
+}
+
+void
+vdatainit(void)
+{
+  if((vdata = (struct vdata*)kalloc()) == 0)
+    panic("vdatainit");
+  memset(vdata, 0, PGSIZE);
+  vdata->timebase = TIMEBASE;
+  vdata->rtc0 = rtcread();
+  vdata->time0 = r_time();
+}
@@ -0,0 +1,26 @@
+// Read-only pages the kernel maps into every process, so that
+// user programs can read this information without a system
+// call. Both the kernel and user programs use this header file.
+
+// At USYSCALL: one page per process, shared by its threads.
+struct usyscall {
+  int pid;
+};
+
+// At VDATA: one page shared by all processes.
+struct vcpu {
+  int pid;            // pid of the process running on this hart, or 0
+  int pad;
+  uint64 idletime;    // time CSR cycles spent idle in wfi
+  uint64 nidle;       // times the hart went idle
+};
+
+struct vdata {
+  uint ticks;         // clock ticks since boot, as uptime()
+  int ncpu;           // harts running the scheduler
+  uint64 timebase;    // time CSR frequency (Hz)
+  uint64 time0;       // time CSR value at calibration...
+  uint64 rtc0;        // ...and the RTC (ns since the epoch) then
+  uint64 nzero;       // read faults that mapped the shared zero page
+  struct vcpu cpu[NCPU];
+};
@@ -5,8 +5,10 @@
 #include "riscv.h"
 #include "defs.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
+#include "vdata.h"
 
 /*
  * the kernel's page table.
@@ -17,6 +19,8 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int demote(pte_t *);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -29,6 +33,9 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT msip words, so harts can send each other IPIs.
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
@@ -62,18 +69,46 @@ kvmmake(void)
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// the parts of the range where va and pa are both 2MB-aligned
+// get megapages, which saves page-table pages and TLB entries
+// (the direct map of RAM is mostly megapages).
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+
+  while(sz > 0){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && sz >= MEGAPGSIZE){
+      if(mapmega(kpgtbl, va, pa, perm) != 0)
+        panic("kvmmap");
+      n = MEGAPGSIZE;
+    } else {
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
+// A page of zeroes, mapped read-only wherever lazily allocated
+// memory has been read but not yet written. Each mapping holds a
+// kalloc() reference to it, and kvminit() holds one that is never
+// dropped, so unmapping it never frees it.
+static uint64 zeropage;
+
 // Initialize the kernel_pagetable, shared by all CPUs.
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = (uint64)kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset((void*)zeropage, 0, PGSIZE);
 }
 
 // Switch the current CPU's h/w page table register to
@@ -102,6 +137,10 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a megapage, return its level-1 leaf PTE, or,
+// if alloc!=0, split it into pages first and return the PTE for
+// va's page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -110,6 +149,11 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_MEGA) && !alloc) {
+      return pte;
+    } else if((*pte & PTE_MEGA) && demote(pte) < 0) {
+      return 0;
+    }
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
@@ -141,10 +185,57 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PAGE(*pte, va);
   return pa;
 }
 
+// Map the 2MB at physical address pa at va with a single
+// level-1 leaf PTE. va and pa must be 2MB-aligned. Returns 0 on
+// success, -1 if a page-table page couldn't be allocated or
+// some of the range already has a page table of its own.
+int
+mapmega(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+  pagetable_t pt;
+
+  if(va % MEGAPGSIZE != 0 || pa % MEGAPGSIZE != 0)
+    panic("mapmega: not aligned");
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    pt = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pt = (pagetable_t)kalloc()) == 0)
+      return -1;
+    memset(pt, 0, PGSIZE);
+    *pte = PA2PTE(pt) | PTE_V;
+  }
+  pte = &pt[PX(1, va)];
+  if(*pte & PTE_V)
+    return -1;
+  *pte = PA2PTE(pa) | perm | PTE_V | PTE_MEGA;
+  return 0;
+}
+
+// Split the megapage that the level-1 leaf *pte maps into 512
+// page PTEs with the same permissions, in a new page-table page,
+// so that part of it can be unmapped or remapped.
+// Returns 0, or -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pt;
+  uint64 pa = PTE2PA(*pte);
+  int perm = PTE_FLAGS(*pte) & ~PTE_MEGA;
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | perm;
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
@@ -206,15 +297,41 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  // with do_free, first only clear PTE_V, keeping the page
+  // addresses, so that no other hart's TLB still maps the pages
+  // when they are freed below.
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
       continue;   
     if((*pte & PTE_V) == 0)  // has physical page been allocated?
       continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if((*pte & PTE_MEGA) && a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= va + npages*PGSIZE){
+      // a whole megapage; its pages have references of their own.
+      *pte = do_free ? *pte & ~PTE_V : 0;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
     }
+    // callers split a megapage that straddles either end of the
+    // range first, with uvmsplit(), where they can fail.
+    if((*pte & PTE_MEGA) && (pte = walk(pagetable, a, 1)) == 0)
+      panic("uvmunmap: demote");
+    *pte = do_free ? *pte & ~PTE_V : 0;
+  }
+  if(!do_free)
+    return;
+
+  tlbshootdown(pagetable);
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    if(*pte & PTE_MEGA){
+      for(int i = 0; i < 512; i++)
+        kfree((void*)(PTE2PA(*pte) + i*PGSIZE));
+      *pte = 0;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    kfree((void*)PTE2PA(*pte));
     *pte = 0;
   }
 }
@@ -232,6 +349,17 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
+    // back each whole, aligned 2MB with a megapage, if there
+    // is a free one.
+    if(a % MEGAPGSIZE == 0 && a + MEGAPGSIZE <= newsz && (mem = kallocmega()) != 0){
+      memset(mem, 0, MEGAPGSIZE);
+      if(mapmega(pagetable, a, (uint64)mem, PTE_R|PTE_U|xperm) == 0){
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      for(int i = 0; i < 512; i++)
+        kfree(mem + i*PGSIZE);
+    }
     mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
@@ -247,10 +375,26 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Split the megapage, if any, that straddles va, so that the
+// pages below va and those above can be unmapped separately.
+// Returns 0, or -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  if(va % MEGAPGSIZE == 0 || (pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & PTE_MEGA) == 0)
+    return 0;
+  return demote(pte);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz, with
+// nothing freed, if a megapage at newsz couldn't be split.
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -258,6 +402,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
     return oldsz;
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    if(uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+      return oldsz;
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
   }
@@ -303,19 +449,47 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz);
+}
+
+// Like uvmcopy, but for the pages in [va, va+len) only.
+// va must be page-aligned.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 len)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < va + len; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
       continue;   // page table entry hasn't been allocated
     if((*pte & PTE_V) == 0)
       continue;   // physical page hasn't been allocated
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
+    if((*pte & PTE_MEGA) && i % MEGAPGSIZE == 0 && i + MEGAPGSIZE <= va + len &&
+       (mem = kallocmega()) != 0){
+      // the child gets a megapage too, if there's a free one.
+      memmove(mem, (char*)PTE2PA(*pte), MEGAPGSIZE);
+      if(mapmega(new, i, (uint64)mem, PTE_FLAGS(*pte) & ~(PTE_MEGA|PTE_V)) == 0){
+        i += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      for(int j = 0; j < 512; j++)
+        kfree(mem + j*PGSIZE);
+    }
+    pa = PTE2PAGE(*pte, i);
+    flags = PTE_FLAGS(*pte) & ~PTE_MEGA;
+    if(pa == zeropage){
+      // still all zeroes; share it.
+      krefinc((void*)pa);
+      if(mappages(new, i, PGSIZE, pa, flags) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -327,7 +501,7 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
@@ -344,6 +518,49 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// The lock to hold while copying to or from a user page of
+// pagetable: the leader's vmlock if pagetable is the current
+// process's, so that a sibling thread's munmap() or sbrk() can't
+// free the page between the walk and the copy, else 0 (exec()'s
+// new page table, which no one else can see yet).
+static struct spinlock*
+copylock(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->leader->pagetable != pagetable)
+    return 0;
+  return &p->leader->vmlock;
+}
+
+// Return the physical address of the user page at va0, faulting
+// it in if need be, with lk (from copylock()) held if it isn't 0.
+// If write is set, the page must be writable: copyout() can't
+// write over read-only text pages, but vmfault() lets it dirty
+// or copy a file page mapped read-only. Returns 0, with lk not
+// held, if the page can't be had.
+static uint64
+copypage(pagetable_t pagetable, uint64 va0, int write, struct spinlock *lk)
+{
+  uint64 pa0;
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  for(;;){
+    if(lk)
+      acquire(lk);
+    pa0 = walkaddr(pagetable, va0);
+    if(pa0 != 0 && (!write || (*(pte = walk(pagetable, va0, 0)) & PTE_W)))
+      return pa0;
+    if(lk)
+      release(lk);
+    // vmfault() takes vmlock itself, and may sleep.
+    if(vmfault(pagetable, va0, !write) == 0)
+      return 0;
+  }
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -351,29 +568,22 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
+  struct proc *p = myproc();
+  struct spinlock *lk = copylock(pagetable);
+
+  if(p)
+    p->ru.outcopy += len;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-      return -1;
-  
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
-
-    pte = walk(pagetable, va0, 0);
-    // forbid copyout over read-only user text pages.
-    if((*pte & PTE_W) == 0)
+    if((pa0 = copypage(pagetable, va0, 1, lk)) == 0)
       return -1;
-      
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
     memmove((void *)(pa0 + (dstva - va0)), src, n);
+    if(lk)
+      release(lk);
 
     len -= n;
     src += n;
@@ -389,19 +599,22 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct proc *p = myproc();
+  struct spinlock *lk = copylock(pagetable);
+
+  if(p)
+    p->ru.incopy += len;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
-        return -1;
-      }
-    }
+    if((pa0 = copypage(pagetable, va0, 0, lk)) == 0)
+      return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
     memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    if(lk)
+      release(lk);
 
     len -= n;
     dst += n;
@@ -419,11 +632,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct spinlock *lk = copylock(pagetable);
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = copypage(pagetable, va0, 0, lk)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -443,6 +656,8 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    if(lk)
+      release(lk);
 
     srcva = va0 + PGSIZE;
   }
@@ -453,31 +668,106 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+// Map the zero page read-only at va, for a read of memory that
+// has never been written. Returns its physical address, or 0.
+uint64
+zeromap(pagetable_t pagetable, uint64 va, int perm)
+{
+  krefinc((void*)zeropage);
+  if(mappages(pagetable, va, PGSIZE, zeropage, perm & ~PTE_W) != 0){
+    kfree((void*)zeropage);
+    return 0;
+  }
+  myproc()->ru.nzero++;
+  __sync_fetch_and_add(&vdata->nzero, 1);
+  return zeropage;
+}
+
+// The first write to a page that zeromap() mapped: replace the
+// zero page at *pte with a zeroed page of the process's own, and
+// make it writable. Returns the new page, or 0 if *pte doesn't
+// map the zero page or memory is exhausted.
+uint64
+zerocopy(pte_t *pte)
+{
+  uint64 mem;
+
+  if(PTE2PA(*pte) != zeropage || (mem = (uint64)kalloc()) == 0)
+    return 0;
+  memset((void*)mem, 0, PGSIZE);
+  *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W;
+  kfree((void*)zeropage);
+  return mem;
+}
+
 // allocate and map user memory if process is referencing a page
 // that was lazily allocated in sys_sbrk().
+// a read maps the shared zero page, and a later write
+// replaces it with a page of the process's own.
+// a write fault on the page just past the previous fault's
+// batch looks like a sequential sweep, so maps twice as many
+// pages as that batch did, up to FAULTAROUND; any other write
+// fault maps just the one page.
 // returns 0 if va is invalid or already mapped, or if
 // out of physical memory, and physical address if successful.
+// if another thread of the process mapped the page first, and
+// it allows the access, returns its physical address.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
-  struct proc *p = myproc();
-
-  if (va >= p->sz)
-    return 0;
+  pte_t *pte;
+  void *pages[FAULTAROUND];
+  int i, j, n;
+  struct proc *p = myproc()->leader;
+
+  acquire(&p->vmlock);
+  if (va >= p->sz) {
+    release(&p->vmlock);
+    return mmapfault(p, va, read);
+  }
   va = PGROUNDDOWN(va);
   if(ismapped(pagetable, va)) {
-    return 0;
+    pte = walk(pagetable, va, 0);
+    if((*pte & PTE_U) == 0)
+      mem = 0;
+    else if(read || (*pte & PTE_W))
+      mem = PTE2PAGE(*pte, va);
+    else if((mem = zerocopy(pte)) != 0)
+      myproc()->ru.nfault++;
+    release(&p->vmlock);
+    return mem;
   }
-  mem = (uint64) kalloc();
-  if(mem == 0)
-    return 0;
-  memset((void *) mem, 0, PGSIZE);
-  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
-    kfree((void *)mem);
+  if(read) {
+    if((mem = zeromap(pagetable, va, PTE_W|PTE_U|PTE_R)) != 0)
+      myproc()->ru.nfault++;
+    release(&p->vmlock);
+    return mem;
+  }
+  n = 1;
+  if(va == p->fault_next)
+    n = p->fault_batch * 2 > FAULTAROUND ? FAULTAROUND : p->fault_batch * 2;
+  for(i = 1; i < n; i++)
+    if(va + i*PGSIZE >= p->sz || ismapped(pagetable, va + i*PGSIZE))
+      break;
+  n = kallocn(pages, i);
+  for(i = 0; i < n; i++){
+    memset(pages[i], 0, PGSIZE);
+    if(mappages(p->pagetable, va + i*PGSIZE, PGSIZE, (uint64)pages[i],
+                PTE_W|PTE_U|PTE_R) != 0)
+      break;
+  }
+  for(j = i; j < n; j++)
+    kfree(pages[j]);
+  if(i == 0) {
+    release(&p->vmlock);
     return 0;
   }
-  return mem;
+  p->fault_next = va + i*PGSIZE;
+  p->fault_batch = i;
+  release(&p->vmlock);
+  myproc()->ru.nfault++;
+  return (uint64) pages[0];
 }
 
 int
@@ -9,6 +9,18 @@ cat(int fd)
 {
   int n;
 
+  // if fd or stdout is a pipe, let the kernel move the data
+  // without copying it through buf.
+  if((n = splice(fd, 1, sizeof(buf) * 8)) >= 0){
+    while(n > 0)
+      n = splice(fd, 1, sizeof(buf) * 8);
+    if(n < 0){
+      fprintf(2, "cat: splice error\n");
+      exit(1);
+    }
+    return;
+  }
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -3,24 +3,6 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-int
-fgets(char *buf, int max, int fd)
-{
-  int i, cc;
-  char c;
-
-  for (i = 0; i + 1 < max; ) {
-    cc = read(fd, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return i;
-}
-
 int
 main(int argc, char *argv[])
 {
@@ -30,6 +12,10 @@ main(int argc, char *argv[])
   }
 
   int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    fprintf(2, "catlines: cannot open %s\n", argv[1]);
+    return 1;
+  }
   char buf[128];
   int line_count = 0;
   while (fgets(buf, 128, fd) > 0 ) {
@@ -0,0 +1,111 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// copybench [kb]
+//
+// Copy a kb-kilobyte file with read()/write() through a user
+// buffer and then with copy_file_range(), and compare the time
+// and the bytes each moves across the user/kernel boundary.
+
+#define CYC2MS(c) ((c) / (TIMEBASE / 1000))
+#define BUFSZ 4096
+
+static char buf[BUFSZ];
+
+static void
+mkfile(char *name, int kb)
+{
+    int fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+    if(fd < 0){
+        fprintf(2, "copybench: cannot create %s\n", name);
+        exit(1);
+    }
+    for(int i = 0; i < BUFSZ; i++)
+        buf[i] = 'a' + i % 26;
+    for(int done = 0; done < kb * 1024; done += BUFSZ){
+        int n = kb * 1024 - done < BUFSZ ? kb * 1024 - done : BUFSZ;
+        if(write(fd, buf, n) != n){
+            fprintf(2, "copybench: write %s failed\n", name);
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+static int
+copyrw(int in, int out)
+{
+    int n;
+
+    while((n = read(in, buf, sizeof(buf))) > 0)
+        if(write(out, buf, n) != n)
+            return -1;
+    return n;
+}
+
+static int
+copykernel(int in, int out)
+{
+    int n;
+
+    while((n = copy_file_range(in, out, 64*1024)) > 0)
+        ;
+    return n;
+}
+
+static void
+run(char *what, int (*copy)(int, int), int kb)
+{
+    struct rusage r0, r1;
+    int in, out;
+
+    in = open("copybench.src", O_RDONLY);
+    out = open("copybench.dst", O_CREATE|O_WRONLY|O_TRUNC);
+    if(in < 0 || out < 0){
+        fprintf(2, "copybench: open failed\n");
+        exit(1);
+    }
+    getrusage(RUSAGE_SELF, &r0);
+    uint64 t0 = rtcgettime();
+    if(copy(in, out) < 0){
+        fprintf(2, "copybench: %s copy failed\n", what);
+        exit(1);
+    }
+    uint64 t1 = rtcgettime();
+    getrusage(RUSAGE_SELF, &r1);
+    close(in);
+    close(out);
+
+    struct stat st;
+    if(stat("copybench.dst", &st) < 0 || st.size != kb * 1024){
+        fprintf(2, "copybench: %s copy has the wrong size\n", what);
+        exit(1);
+    }
+    printf("%s\t%lu ms\t%lu ms sys\t%lu bytes in\t%lu bytes out\n", what,
+           (t1 - t0) / 1000000, CYC2MS(r1.stime - r0.stime),
+           r1.incopy - r0.incopy, r1.outcopy - r0.outcopy);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int kb = 200;
+
+    if(argc > 1)
+        kb = atoi(argv[1]);
+    if(kb <= 0){
+        fprintf(2, "Usage: copybench [kb]\n");
+        exit(1);
+    }
+
+    mkfile("copybench.src", kb);
+    run("read/write", copyrw, kb);
+    run("copy_file_range", copykernel, kb);
+    unlink("copybench.src");
+    unlink("copybench.dst");
+    exit(0);
+}
@@ -0,0 +1,59 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// cp src dst: copy a file with copy_file_range(), so the data
+// never passes through user memory. If dst is a directory, the
+// copy goes in it under src's last path element.
+
+#define CHUNK (64*1024)
+
+int
+main(int argc, char *argv[])
+{
+  char path[128];
+  char *dst, *base, *p;
+  struct stat st;
+  int in, out, n;
+
+  if(argc != 3){
+    fprintf(2, "Usage: cp src dst\n");
+    exit(1);
+  }
+
+  dst = argv[2];
+  if(stat(dst, &st) == 0 && st.type == T_DIR){
+    base = argv[1];
+    for(p = argv[1]; *p; p++)
+      if(*p == '/')
+        base = p + 1;
+    if(strlen(dst) + 1 + strlen(base) + 1 > sizeof(path)){
+      fprintf(2, "cp: path too long\n");
+      exit(1);
+    }
+    strcpy(path, dst);
+    p = path + strlen(path);
+    *p++ = '/';
+    strcpy(p, base);
+    dst = path;
+  }
+
+  if((in = open(argv[1], O_RDONLY)) < 0){
+    fprintf(2, "cp: cannot open %s\n", argv[1]);
+    exit(1);
+  }
+  if((out = open(dst, O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    fprintf(2, "cp: cannot create %s\n", dst);
+    exit(1);
+  }
+  while((n = copy_file_range(in, out, CHUNK)) > 0)
+    ;
+  if(n < 0){
+    fprintf(2, "cp: copy to %s failed\n", dst);
+    exit(1);
+  }
+  close(in);
+  close(out);
+  exit(0);
+}
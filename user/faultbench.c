@@ -0,0 +1,87 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/mman.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// faultbench [mb]
+//
+// Touch mb megabytes of lazily allocated memory one page at a
+// time, and report the page faults that took per megabyte and
+// the time. vmfault() maps up to FAULTAROUND pages per fault
+// when the heap is swept in order, so "sbrk sequential" should
+// need far fewer faults than the 256 per megabyte that scattered
+// touches and anonymous mmap() (which maps one page per fault)
+// cost.
+
+#define MB (1024*1024)
+
+// Touch every page of buf, in order or scattered.
+static void
+touch(char *buf, int npages, int scattered)
+{
+    for(int i = 0; i < npages; i++){
+        // 97 is odd, so this visits every page once.
+        int pg = scattered ? (int)(((uint64)i * 97) % npages) : i;
+        buf[pg * PGSIZE] = 1;
+    }
+}
+
+static void
+run(char *what, char *buf, int mb, int scattered)
+{
+    struct rusage r0, r1;
+
+    getrusage(RUSAGE_SELF, &r0);
+    uint64 t0 = rtcgettime();
+    touch(buf, mb * (MB / PGSIZE), scattered);
+    uint64 t1 = rtcgettime();
+    getrusage(RUSAGE_SELF, &r1);
+    printf("%s\t%lu faults/MB\t%lu us\n", what,
+           (r1.nfault - r0.nfault) / mb, (t1 - t0) / 1000);
+}
+
+// Lazily grow the heap by mb megabytes, page-aligned.
+static char *
+lazyheap(int mb)
+{
+    char *a = sbrklazy(mb * MB + PGSIZE);
+    if(a == SBRK_ERROR){
+        fprintf(2, "faultbench: sbrklazy failed\n");
+        exit(1);
+    }
+    return (char *)PGROUNDUP((uint64)a);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int mb = 4;
+    char *a;
+
+    if(argc > 1)
+        mb = atoi(argv[1]);
+    if(mb <= 0){
+        fprintf(2, "Usage: faultbench [mb]\n");
+        exit(1);
+    }
+
+    a = lazyheap(mb);
+    run("sbrk sequential", a, mb, 0);
+    sbrk(-(mb * MB + PGSIZE));
+
+    a = lazyheap(mb);
+    run("sbrk scattered", a, mb, 1);
+    sbrk(-(mb * MB + PGSIZE));
+
+    a = (char *)mmap(0, mb * MB, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    if(a == (char *)-1){
+        fprintf(2, "faultbench: mmap failed\n");
+        exit(1);
+    }
+    run("mmap sequential", a, mb, 0);
+    munmap((uint64)a, mb * MB);
+    exit(0);
+}
@@ -2,8 +2,9 @@
 #include "user/user.h"
 
 int main(int argc, char *argv[]) {
-  char *line = malloc(512);
-  while (getline(&line, 512, 0) > 0) {
+  char *line = 0;
+  uint size = 0;
+  while (getline(&line, &size, 0) > 0) {
     for (int i = 1; i < argc; i += 2) {
       char *find = argv[i];
       char *repl = argv[i + 1];
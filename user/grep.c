@@ -5,32 +5,20 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[1024];
+char *line;
+uint linesz;
 int match(char*, char*);
 
 void
 grep(char *pattern, int fd)
 {
-  int n, m;
-  char *p, *q;
+  int n;
 
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
-    }
+  while((n = getline(&line, &linesz, fd)) >= 0){
+    if(line[n-1] == '\n')
+      line[n-1] = 0;
+    if(match(pattern, line))
+      printf("%s\n", line);
   }
 }
 
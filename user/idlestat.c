@@ -0,0 +1,39 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+    uint64 before[NCPU], after[NCPU];
+    int ticks = 10;
+
+    if(argc > 1)
+        ticks = atoi(argv[1]);
+    if(ticks <= 0){
+        fprintf(2, "Usage: idlestat [ticks]\n");
+        exit(1);
+    }
+
+    int ncpu = cpuidle(before, NCPU);
+    if(ncpu < 0){
+        fprintf(2, "idlestat: cpuidle failed\n");
+        exit(1);
+    }
+    int t0 = uptime();
+    pause(ticks);
+    cpuidle(after, NCPU);
+    int elapsed = uptime() - t0;
+    if(elapsed <= 0)
+        elapsed = 1;
+
+    for(int i = 0; i < ncpu && i < NCPU; i++){
+        uint64 idle = after[i] - before[i];
+        uint64 pct = (idle * 100) / ((uint64)elapsed * TICKCYCLES);
+        if(pct > 100)
+            pct = 100;
+        printf("hart %d: %lu%% idle (%lu cycles over %d ticks)\n",
+               i, pct, idle, elapsed);
+    }
+    exit(0);
+}
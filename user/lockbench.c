@@ -0,0 +1,120 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// lockbench [-n acquires]
+//
+// Compare the kernel's test-and-set spinlock with its ticket
+// lock: for 1..ncpu processes all hammering the same lock, print
+// the acquire throughput and the median, 99th percentile and
+// worst acquire latency.
+
+#define NS_PER_CYCLE (1000000000/TIMEBASE)
+
+static char *kinds[] = {
+    [LOCKBENCH_TAS]    "tas",
+    [LOCKBENCH_TICKET] "ticket",
+};
+
+// Upper bound, in ns, of the histogram bucket holding the
+// p-th percentile.
+static uint64
+percentile(struct lockbench *r, int p)
+{
+    uint64 want = (r->nacquire * p + 99) / 100;
+    uint64 seen = 0;
+
+    for(int b = 0; b < LOCKBENCH_NHIST; b++){
+        seen += r->hist[b];
+        if(seen >= want)
+            return ((uint64)1 << b) * NS_PER_CYCLE;
+    }
+    return r->maxwait * NS_PER_CYCLE;
+}
+
+static int
+run(int kind, int nproc, int n)
+{
+    struct lockbench r, sum;
+    int fds[NCPU][2];
+
+    // one pipe per child, so that results can't interleave.
+    for(int i = 0; i < nproc; i++){
+        if(pipe(fds[i]) < 0){
+            fprintf(2, "lockbench: pipe failed\n");
+            return -1;
+        }
+        int pid = fork();
+        if(pid < 0){
+            fprintf(2, "lockbench: fork failed\n");
+            return -1;
+        }
+        if(pid == 0){
+            close(fds[i][0]);
+            if(lockbench(kind, n, &r) < 0)
+                exit(1);
+            write(fds[i][1], &r, sizeof(r));
+            exit(0);
+        }
+        close(fds[i][1]);
+    }
+
+    memset(&sum, 0, sizeof(sum));
+    for(int i = 0; i < nproc; i++){
+        if(read(fds[i][0], &r, sizeof(r)) == sizeof(r)){
+            sum.nacquire += r.nacquire;
+            if(r.elapsed > sum.elapsed)
+                sum.elapsed = r.elapsed;
+            if(r.maxwait > sum.maxwait)
+                sum.maxwait = r.maxwait;
+            for(int b = 0; b < LOCKBENCH_NHIST; b++)
+                sum.hist[b] += r.hist[b];
+        }
+        close(fds[i][0]);
+    }
+    for(int i = 0; i < nproc; i++)
+        wait(0);
+
+    if(sum.nacquire == 0 || sum.elapsed == 0){
+        fprintf(2, "lockbench: %s x%d failed\n", kinds[kind], nproc);
+        return -1;
+    }
+    printf("%s\t%d\t%lu\t\t%lu\t%lu\t%lu\n", kinds[kind], nproc,
+           sum.nacquire * (TIMEBASE / 1000) / sum.elapsed,
+           percentile(&sum, 50), percentile(&sum, 99),
+           sum.maxwait * NS_PER_CYCLE);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint64 idle[NCPU];
+    int n = 100000;
+
+    if(argc > 2 && strcmp(argv[1], "-n") == 0)
+        n = atoi(argv[2]);
+    else if(argc > 1){
+        fprintf(2, "Usage: lockbench [-n acquires]\n");
+        exit(1);
+    }
+    if(n <= 0){
+        fprintf(2, "lockbench: bad -n\n");
+        exit(1);
+    }
+
+    int ncpu = cpuidle(idle, NCPU);
+    if(ncpu <= 0 || ncpu > NCPU)
+        ncpu = NCPU;
+
+    printf("%d acquires per process, %d harts\n", n, ncpu);
+    printf("lock\tprocs\tacquires/ms\tp50(ns)\tp99(ns)\tmax(ns)\n");
+    for(int kind = LOCKBENCH_TAS; kind <= LOCKBENCH_TICKET; kind++){
+        for(int nproc = 1; nproc <= ncpu; nproc++){
+            if(run(kind, nproc, n) < 0)
+                exit(1);
+        }
+    }
+    exit(0);
+}
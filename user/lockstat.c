@@ -0,0 +1,77 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// lockstat [program [args...]]
+//
+// Print the kernel's per-lock-name contention counters, most
+// contended first. With a program, print only the counts
+// accumulated while it ran (maxhold stays the all-time maximum).
+
+#define CYCLES_PER_US (TIMEBASE/1000000)
+
+static struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+int
+main(int argc, char *argv[])
+{
+    int n0 = 0, n, i, j;
+    int order[NLOCKSTAT];
+
+    if(argc > 1){
+        if((n0 = lockstat(before, NLOCKSTAT)) < 0){
+            fprintf(2, "lockstat: lockstat failed\n");
+            exit(1);
+        }
+        int pid = fork();
+        if(pid < 0){
+            fprintf(2, "lockstat: fork failed\n");
+            exit(1);
+        }
+        if(pid == 0){
+            exec(argv[1], &argv[1]);
+            fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+            exit(1);
+        }
+        wait(0);
+    }
+
+    if((n = lockstat(after, NLOCKSTAT)) < 0){
+        fprintf(2, "lockstat: lockstat failed\n");
+        exit(1);
+    }
+
+    // entries are only ever appended, so index i names the same
+    // lock in both snapshots.
+    for(i = 0; i < n0 && i < n; i++){
+        after[i].nacquire -= before[i].nacquire;
+        after[i].ncontended -= before[i].ncontended;
+        after[i].waittime -= before[i].waittime;
+    }
+
+    // sort by time spent waiting, then by contended acquisitions.
+    for(i = 0; i < n; i++){
+        struct lockstat *s = &after[i];
+        for(j = i; j > 0 && (after[order[j-1]].waittime < s->waittime ||
+            (after[order[j-1]].waittime == s->waittime &&
+             after[order[j-1]].ncontended < s->ncontended)); j--)
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+
+    printf("name            kind  locks  acquire  contend  wait(us)  maxhold(us)\n");
+    for(i = 0; i < n; i++){
+        struct lockstat *s = &after[order[i]];
+        if(s->nacquire == 0 && s->ncontended == 0)
+            continue;
+        printf("%s", s->name);
+        for(j = strlen(s->name); j < LOCKNAME; j++)
+            printf(" ");
+        printf("%s  %d\t%lu\t%lu\t%lu\t%lu\n",
+               s->kind == LOCK_SLEEP ? "sleep" : "spin ",
+               s->nlocks, s->nacquire, s->ncontended,
+               s->waittime / CYCLES_PER_US, s->maxhold / CYCLES_PER_US);
+    }
+    exit(0);
+}
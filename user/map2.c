@@ -1,9 +1,10 @@
 #include "kernel/types.h"
+#include "kernel/mman.h"
 #include "user.h"
 
 int main(void) {
     printf("MAP2: calling mmap...\n");
-    uint64 addr = mmap(0, 4096, 0, 0, -1, 0); // ignore prot/flags
+    uint64 addr = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
     if(addr == (uint64)-1){
         printf("MAP2: mmap failed\n");
         exit(1);
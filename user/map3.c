@@ -1,4 +1,5 @@
 #include "kernel/types.h"
+#include "kernel/mman.h"
 #include "user/user.h"
 
 int main(void) {
@@ -9,7 +10,7 @@ int main(void) {
     printf("Free memory before mapping: %d KiB\n", free_before);
 
     // Map one shared page
-    uint64 addr = mmap(0, 4096, 0, 0, -1, 0);
+    uint64 addr = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
     if(addr == (uint64)-1){
         printf("MAPTEST: mmap failed\n");
         exit(1);
@@ -0,0 +1,104 @@
+#include "kernel/types.h"
+#include "kernel/kmemstat.h"
+#include "kernel/slabstat.h"
+#include "user/user.h"
+
+// memstat [-s rounds [nproc]]
+//
+// Print the physical memory allocator's free blocks by order and
+// how fragmented free memory is: the share of free pages that are
+// not in blocks big enough for a megapage. With -s, first run
+// kmemstress() for the given number of rounds in nproc processes
+// at once (default 4), and report the counters it moved.
+// Then print the slab caches of small kernel objects.
+
+#define NSLAB 8
+
+static void
+print(struct kmemstat *st, struct kmemstat *before)
+{
+    uint64 free = 0, big = 0, n;
+    int k;
+
+    printf("order  size(KiB)  free blocks  allocs\n");
+    for(k = 0; k <= KMAXORDER; k++){
+        n = st->nalloc[k] - (before ? before->nalloc[k] : 0);
+        printf("%d\t%d\t   %lu\t\t%lu\n", k, 4 << k, st->nfree[k], n);
+        free += st->nfree[k] << k;
+        if(k >= MEGAORDER)
+            big += st->nfree[k] << k;
+    }
+    printf("free %lu of %lu pages (%lu KiB)\n", free, st->npages, free * 4);
+    printf("fragmented %lu%% (free pages in blocks under %d KiB)\n",
+           free ? (free - big) * 100 / free : 0, 4 << MEGAORDER);
+    if(before)
+        printf("splits %lu  merges %lu  failed %lu\n",
+               st->nsplit - before->nsplit, st->nmerge - before->nmerge,
+               st->nfail - before->nfail);
+}
+
+static void
+printslabs(void)
+{
+    struct slabstat sl[NSLAB];
+    int n, i;
+
+    if((n = slabstat(sl, NSLAB)) < 0){
+        fprintf(2, "memstat: slabstat failed\n");
+        return;
+    }
+    printf("cache   size  slab(KiB)  per slab  slabs  in use  magazines  allocs\n");
+    for(i = 0; i < n; i++)
+        printf("%s\t%d\t%d\t   %d\t     %lu\t    %lu\t    %lu\t  %lu\n",
+               sl[i].name, sl[i].size, 4 << sl[i].order, sl[i].perslab,
+               sl[i].nslab, sl[i].ninuse - sl[i].nmag, sl[i].nmag,
+               sl[i].nalloc);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct kmemstat before, st;
+    int rounds = 0, nproc = 4, i, status, bad = 0;
+
+    if(argc > 1){
+        if(strcmp(argv[1], "-s") != 0 || argc < 3){
+            fprintf(2, "usage: memstat [-s rounds [nproc]]\n");
+            exit(1);
+        }
+        rounds = atoi(argv[2]);
+        if(argc > 3)
+            nproc = atoi(argv[3]);
+    }
+
+    if(kmemstat(&before) < 0){
+        fprintf(2, "memstat: kmemstat failed\n");
+        exit(1);
+    }
+    if(rounds > 0 && kmemstress(0, 0) < 0){
+        fprintf(2, "memstat: no kmemstress(); build with KMEMSTRESS=1\n");
+        exit(1);
+    }
+    if(rounds > 0){
+        for(i = 0; i < nproc; i++){
+            int pid = fork();
+            if(pid < 0){
+                fprintf(2, "memstat: fork failed\n");
+                exit(1);
+            }
+            if(pid == 0)
+                exit(kmemstress(rounds, i + 1) < 0 ? 1 : 0);
+        }
+        for(i = 0; i < nproc; i++){
+            wait(&status);
+            if(status != 0)
+                bad++;
+        }
+        if(bad)
+            printf("memstat: %d stress runs found corruption\n", bad);
+    }
+    kmemstat(&st);
+    print(&st, rounds > 0 ? &before : 0);
+    printslabs();
+    exit(bad ? 1 : 0);
+}
@@ -1,11 +1,12 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/mman.h"
 #include "user.h"
 
 int main(void) {
-    char *p1 = (char*)mmap(0, 4096, 0, 0, -1, 0);
-    char *p2 = (char*)mmap(0, 4096, 0, 0, -1, 0);
-    char *p3 = (char*)mmap(0, 4096, 0, 0, -1, 0);
+    char *p1 = (char*)mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    char *p2 = (char*)mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    char *p3 = (char*)mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
 
     strcpy(p1, "hello world!");
     strcpy(p2, "page two");
@@ -1,23 +1,114 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/uring.h"
 #include "user/user.h"
 
 #include <stdarg.h>
 
 static char digits[] = "0123456789ABCDEF";
 
+// Buffered output.
+//
+// Each fd gets a buffer on first use. Output to the console (and
+// anything on fd 2) is line buffered: flushed at each newline and
+// at the end of every printf(). Output to files and pipes is
+// flushed when the buffer fills, by fflush(), and before the
+// process writes the fd directly, closes it (with close() or
+// through a uring), or calls fork(), exec() or exit(), so output
+// stays in order and isn't lost or duplicated (see the wrappers
+// at the end of this file).
+//
+// outlock guards the output buffers, so threads may print; each
+// printf() holds it throughout, so its output isn't interleaved
+// with another thread's. inlock, below, does the same for input.
+
+#define OUTBUFSZ 512
+
+enum { UNKNOWN, LINEBUF, FULLBUF };
+
+struct outbuf {
+  int mode;
+  int n;
+  char buf[OUTBUFSZ];
+};
+
+static struct outbuf outbufs[NOFILE];
+static pthread_mutex_t outlock;
+
+static struct outbuf*
+getbuf(int fd)
+{
+  struct outbuf *b;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  b = &outbufs[fd];
+  if(b->mode == UNKNOWN){
+    if(fd == 2 || (fstat(fd, &st) == 0 && st.type == T_DEVICE))
+      b->mode = LINEBUF;
+    else
+      b->mode = FULLBUF;
+  }
+  return b;
+}
+
+// Caller must hold outlock.
+static void
+flush(int fd)
+{
+  struct outbuf *b;
+  int i, n;
+
+  if(fd < 0 || fd >= NOFILE)
+    return;
+  b = &outbufs[fd];
+  for(i = 0; i < b->n; i += n){
+    if((n = sys_write(fd, b->buf + i, b->n - i)) <= 0)
+      break;
+  }
+  b->n = 0;
+}
+
+void
+fflush(int fd)
+{
+  pthread_mutex_lock(&outlock);
+  flush(fd);
+  pthread_mutex_unlock(&outlock);
+}
+
+void
+flushall(void)
+{
+  pthread_mutex_lock(&outlock);
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(outbufs[fd].n > 0)
+      flush(fd);
+  pthread_mutex_unlock(&outlock);
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct outbuf *b = getbuf(fd);
+
+  if(b == 0){
+    sys_write(fd, &c, 1);
+    return;
+  }
+  b->buf[b->n++] = c;
+  if(b->n == OUTBUFSZ || (c == '\n' && b->mode == LINEBUF))
+    flush(fd);
 }
 
 static void
 printint(int fd, long long xx, int base, int sgn)
 {
-  char buf[20];
+  char buf[24];
   int i, neg;
-  uint x;
+  unsigned long long x;
 
   neg = 0;
   if(sgn && xx < 0){
@@ -54,6 +145,7 @@ vprintf(int fd, const char *fmt, va_list ap)
   char *s;
   int c0, c1, c2, i, state;
 
+  pthread_mutex_lock(&outlock);
   state = 0;
   for(i = 0; fmt[i]; i++){
     c0 = fmt[i] & 0xff;
@@ -111,6 +203,10 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+
+  if(fd >= 0 && fd < NOFILE && outbufs[fd].mode == LINEBUF)
+    flush(fd);
+  pthread_mutex_unlock(&outlock);
 }
 
 void
@@ -130,3 +226,243 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+// Buffered input.
+//
+// getc() and the line readers built on it fill a per-fd buffer
+// with one read() at a time rather than reading a byte per call.
+// Like any read-ahead, this can consume input past the current
+// line, so a process that hands an fd to a child (sh running a
+// script on fd 0, say, or smash) should keep using read() or
+// gets() on it.
+// The console returns at most one line per read(), so buffering
+// it is always safe.
+
+#define INBUFSZ 512
+
+struct inbuf {
+  int pos;
+  int len;
+  char buf[INBUFSZ];
+};
+
+static struct inbuf inbufs[NOFILE];
+static pthread_mutex_t inlock;
+
+// Return the next byte from fd as an unsigned char, -1 at end
+// of file, or -2 on a read error.
+// Caller must hold inlock.
+static int
+nextc(int fd)
+{
+  struct inbuf *b;
+  unsigned char c;
+  int n;
+
+  if(fd < 0 || fd >= NOFILE){
+    n = read(fd, &c, 1);
+    return n == 1 ? c : (n == 0 ? -1 : -2);
+  }
+  b = &inbufs[fd];
+  if(b->pos == b->len){
+    b->pos = b->len = 0;
+    if((n = read(fd, b->buf, INBUFSZ)) <= 0)
+      return n == 0 ? -1 : -2;
+    b->len = n;
+  }
+  return (unsigned char)b->buf[b->pos++];
+}
+
+int
+getc(int fd)
+{
+  int c;
+
+  pthread_mutex_lock(&inlock);
+  c = nextc(fd);
+  pthread_mutex_unlock(&inlock);
+  return c;
+}
+
+// Push c back so that the next getc(fd) returns it.
+// At least one byte of push-back is always possible.
+// Returns c, or -1.
+int
+ungetc(int c, int fd)
+{
+  struct inbuf *b;
+
+  if(c < 0 || fd < 0 || fd >= NOFILE)
+    return -1;
+  pthread_mutex_lock(&inlock);
+  b = &inbufs[fd];
+  if(b->pos == 0){
+    if(b->len == INBUFSZ){
+      pthread_mutex_unlock(&inlock);
+      return -1;
+    }
+    memmove(b->buf + 1, b->buf, b->len);
+    b->pos = 1;
+    b->len++;
+  }
+  b->buf[--b->pos] = c;
+  pthread_mutex_unlock(&inlock);
+  return c;
+}
+
+// Read a line, including its newline, into buf of size max and
+// null-terminate it. A line longer than max-1 bytes is returned
+// in pieces. Returns the number of bytes read, or -1 at end of
+// file or on error.
+int
+fgets(char *buf, unsigned int max, int fd)
+{
+  int i, c;
+
+  pthread_mutex_lock(&inlock);
+  for(i = 0; i+1 < max; ){
+    if((c = nextc(fd)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  pthread_mutex_unlock(&inlock);
+  if(max > 0)
+    buf[i] = '\0';
+  return i > 0 ? i : -1;
+}
+
+// Like fgets, but reads a whole line however long, into a
+// malloc'd buffer *buf of capacity *size. If *buf is null or too
+// small it is grown, doubling, so a long line costs amortized
+// O(1) per byte. Returns the line's length, or -1 at end of file
+// or on error.
+int
+getline(char **buf, uint *size, int fd)
+{
+  uint n = 0;
+  int c;
+  char *nbuf;
+
+  if(*buf == 0)
+    *size = 0;
+  pthread_mutex_lock(&inlock);
+  while((c = nextc(fd)) >= 0){
+    if(n + 2 > *size){
+      uint nsize = *size < 64 ? 64 : *size * 2;
+      if((nbuf = malloc(nsize)) == 0){
+        pthread_mutex_unlock(&inlock);
+        return -1;
+      }
+      if(*buf){
+        memmove(nbuf, *buf, n);
+        free(*buf);
+      }
+      *buf = nbuf;
+      *size = nsize;
+    }
+    (*buf)[n++] = c;
+    if(c == '\n')
+      break;
+  }
+  pthread_mutex_unlock(&inlock);
+  if(n == 0)
+    return -1;
+  (*buf)[n] = '\0';
+  return n;
+}
+
+// System call wrappers that keep buffered I/O in order.
+// usys.S names the real system calls sys_write and so on.
+
+// Flush fd's output and drop its input, and forget what kind of
+// file fd is, because it is being closed or replaced.
+// Caller must hold outlock.
+static void
+resetbuf(int fd)
+{
+  if(fd >= 0 && fd < NOFILE){
+    flush(fd);
+    outbufs[fd].mode = UNKNOWN;
+    pthread_mutex_lock(&inlock);
+    inbufs[fd].pos = inbufs[fd].len = 0;
+    pthread_mutex_unlock(&inlock);
+  }
+}
+
+int
+write(int fd, const void *buf, int n)
+{
+  if(fd >= 0 && fd < NOFILE && outbufs[fd].n > 0)
+    fflush(fd);
+  return sys_write(fd, buf, n);
+}
+
+int
+close(int fd)
+{
+  pthread_mutex_lock(&outlock);
+  resetbuf(fd);
+  pthread_mutex_unlock(&outlock);
+  return sys_close(fd);
+}
+
+// There is no dup2 system call: emulate it with close() and
+// dup(), which returns the lowest free fd, newfd.
+void
+dup2(int oldfd, int newfd)
+{
+  if(oldfd == newfd)
+    return;
+  pthread_mutex_lock(&outlock);
+  flush(oldfd);
+  resetbuf(newfd);
+  pthread_mutex_unlock(&outlock);
+  sys_close(newfd);
+  if(dup(oldfd) != newfd){
+    fprintf(2, "dup2 failed\n");
+    exit(1);
+  }
+}
+
+// The queued operations that uring_enter() will run are writes
+// and closes too: flush before them, as write() and close() do.
+int
+uring_enter(struct uring *r, int n)
+{
+  struct uring_sqe *e;
+  uint i;
+
+  pthread_mutex_lock(&outlock);
+  for(i = r->sq_head; i != r->sq_tail && i - r->sq_head < n; i++){
+    e = &r->sq[i % URING_ENTRIES];
+    if(e->op == URING_WRITE)
+      flush(e->fd);
+    else if(e->op == URING_CLOSE)
+      resetbuf(e->fd);
+  }
+  pthread_mutex_unlock(&outlock);
+  return sys_uring_enter(r, n);
+}
+
+int
+fork(void)
+{
+  flushall();
+  return sys_fork();
+}
+
+int
+exec(const char *path, char **argv)
+{
+  flushall();
+  return sys_exec(path, argv);
+}
+
+int
+exit(int status)
+{
+  flushall();
+  sys_exit(status);
+}
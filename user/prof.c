@@ -0,0 +1,342 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+// prof [-i usec] program [args...]
+//
+// Run program with the kernel's sampling profiler on, then
+// print a flat profile and the hottest call-graph edges of its
+// samples, symbolized with /sym/kernel.sym and /sym/<program>.sym
+// (the Makefile copies the .sym files into fs.img).
+
+#define KERNBASE 0x80000000L
+#define NREAD 64       // samples per profread()
+#define MAXEDGES 512
+#define TOPFUNCS 20
+#define TOPEDGES 30
+
+struct sym {
+    uint64 addr;
+    char *name;
+};
+
+struct symtab {
+    struct sym *syms;
+    int n;
+};
+
+struct edge {
+    int from;    // caller
+    int to;      // callee
+    int n;
+};
+
+static struct symtab ksyms, usyms;
+static int nfuncs;          // ksyms.n + usyms.n + 1 for "unknown"
+static int *self, *total;
+static struct edge edges[MAXEDGES];
+static int nedges;
+static int nsamples, nuser;
+
+static int
+hexval(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Skip section and file names; keep functions and data.
+static int
+wanted(char *name)
+{
+    int n = strlen(name);
+    if(n == 0 || name[0] == '.')
+        return 0;
+    if(n > 2 && name[n-2] == '.' && (name[n-1] == 'c' || name[n-1] == 'o' || name[n-1] == 'S'))
+        return 0;
+    return 1;
+}
+
+// Load a "address name" per line symbol table, as written by
+// the Makefile's objdump | sed, sorted by address.
+static int
+loadsyms(char *path, struct symtab *t)
+{
+    struct stat st;
+    char *buf, *p, *end;
+    int fd, n, lines;
+
+    t->syms = 0;
+    t->n = 0;
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+        close(fd);
+        return -1;
+    }
+    for(n = 0; n < st.size; ){
+        int r = read(fd, buf + n, st.size - n);
+        if(r <= 0)
+            break;
+        n += r;
+    }
+    close(fd);
+    buf[n] = '\0';
+    end = buf + n;
+
+    lines = 0;
+    for(p = buf; p < end; p++)
+        if(*p == '\n')
+            lines++;
+    if((t->syms = malloc((lines + 1) * sizeof(struct sym))) == 0)
+        return -1;
+
+    for(p = buf; p < end; ){
+        uint64 addr = 0;
+        int v;
+        while(p < end && (v = hexval(*p)) >= 0){
+            addr = (addr << 4) | v;
+            p++;
+        }
+        while(p < end && *p == ' ')
+            p++;
+        char *name = p;
+        while(p < end && *p != '\n')
+            p++;
+        if(p < end)
+            *p++ = '\0';
+        if(wanted(name)){
+            t->syms[t->n].addr = addr;
+            t->syms[t->n].name = name;
+            t->n++;
+        }
+    }
+
+    // shell sort by address.
+    for(int gap = t->n / 2; gap > 0; gap /= 2){
+        for(int i = gap; i < t->n; i++){
+            struct sym s = t->syms[i];
+            int j;
+            for(j = i; j >= gap && t->syms[j-gap].addr > s.addr; j -= gap)
+                t->syms[j] = t->syms[j-gap];
+            t->syms[j] = s;
+        }
+    }
+    return 0;
+}
+
+// Index of the function containing pc: kernel symbols first,
+// then user symbols, then nfuncs-1 for "unknown".
+static int
+lookup(uint64 pc)
+{
+    struct symtab *t = pc >= KERNBASE ? &ksyms : &usyms;
+    int base = pc >= KERNBASE ? 0 : ksyms.n;
+    int lo = 0, hi = t->n - 1, found = -1;
+
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        if(t->syms[mid].addr <= pc){
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if(found < 0)
+        return nfuncs - 1;
+    return base + found;
+}
+
+static char *
+funcname(int i)
+{
+    if(i < ksyms.n)
+        return ksyms.syms[i].name;
+    if(i < ksyms.n + usyms.n)
+        return usyms.syms[i - ksyms.n].name;
+    return "(unknown)";
+}
+
+static void
+addedge(int from, int to)
+{
+    for(int i = 0; i < nedges; i++){
+        if(edges[i].from == from && edges[i].to == to){
+            edges[i].n++;
+            return;
+        }
+    }
+    if(nedges < MAXEDGES){
+        edges[nedges].from = from;
+        edges[nedges].to = to;
+        edges[nedges].n = 1;
+        nedges++;
+    }
+}
+
+static void
+account(struct profsample *s)
+{
+    int frames[PROFDEPTH + 1];
+    int n = 0;
+
+    frames[n++] = lookup(s->pc);
+    for(int i = 0; i < s->depth && i < PROFDEPTH; i++)
+        frames[n++] = lookup(s->stack[i]);
+
+    nsamples++;
+    if(s->user)
+        nuser++;
+    self[frames[0]]++;
+
+    // count each function once per sample for its total,
+    // even if it recurses.
+    for(int i = 0; i < n; i++){
+        int seen = 0;
+        for(int j = 0; j < i; j++)
+            if(frames[j] == frames[i])
+                seen = 1;
+        if(!seen)
+            total[frames[i]]++;
+        if(i > 0)
+            addedge(frames[i], frames[i-1]);
+    }
+}
+
+static void
+report(int usec)
+{
+    int *order = malloc(nfuncs * sizeof(int));
+    int i, j, nz = 0;
+
+    printf("%d samples (%d user, %d kernel), one every %d us\n\n",
+           nsamples, nuser, nsamples - nuser, usec);
+    if(nsamples == 0 || order == 0)
+        return;
+
+    for(i = 0; i < nfuncs; i++)
+        if(total[i] > 0)
+            order[nz++] = i;
+    // sort by self, then total, descending.
+    for(i = 1; i < nz; i++){
+        int f = order[i];
+        for(j = i; j > 0 && (self[order[j-1]] < self[f] ||
+            (self[order[j-1]] == self[f] && total[order[j-1]] < total[f])); j--)
+            order[j] = order[j-1];
+        order[j] = f;
+    }
+
+    printf("flat profile:\n");
+    printf("  self%%   self  total  function\n");
+    for(i = 0; i < nz && i < TOPFUNCS; i++){
+        int f = order[i];
+        printf("  %d%%\t%d\t%d\t%s\n", self[f] * 100 / nsamples, self[f], total[f], funcname(f));
+    }
+
+    // sort edges by count, descending.
+    for(i = 1; i < nedges; i++){
+        struct edge e = edges[i];
+        for(j = i; j > 0 && edges[j-1].n < e.n; j--)
+            edges[j] = edges[j-1];
+        edges[j] = e;
+    }
+
+    printf("\ncall graph (caller -> callee):\n");
+    for(i = 0; i < nedges && i < TOPEDGES; i++)
+        printf("  %d\t%s -> %s\n", edges[i].n, funcname(edges[i].from), funcname(edges[i].to));
+}
+
+// Drain samples until profiling stops, keeping those of pid.
+static void
+collect(int pid, char *prog, int usec)
+{
+    static struct profsample buf[NREAD];
+    char path[64];
+    char *base = prog;
+    int n;
+
+    for(char *p = prog; *p; p++)
+        if(*p == '/')
+            base = p + 1;
+    if(strlen(base) + 10 > sizeof(path))
+        base = "";
+    strcpy(path, "/sym/");
+    strcpy(path + strlen(path), base);
+    strcpy(path + strlen(path), ".sym");
+    // mkfs cut names longer than DIRSIZ (umalloctests.sym is
+    // 16), so look for the name it actually wrote.
+    path[5 + DIRSIZ] = 0;
+
+    if(loadsyms("/sym/kernel.sym", &ksyms) < 0)
+        fprintf(2, "prof: no /sym/kernel.sym, kernel pcs unsymbolized\n");
+    if(loadsyms(path, &usyms) < 0)
+        fprintf(2, "prof: no %s, user pcs unsymbolized\n", path);
+    nfuncs = ksyms.n + usyms.n + 1;
+    self = calloc(nfuncs, sizeof(int));
+    total = calloc(nfuncs, sizeof(int));
+    if(self == 0 || total == 0){
+        fprintf(2, "prof: out of memory\n");
+        exit(1);
+    }
+
+    while((n = profread(buf, NREAD)) > 0){
+        for(int i = 0; i < n; i++)
+            if(buf[i].pid == pid)
+                account(&buf[i]);
+    }
+    report(usec);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int usec = 1000;
+    int i = 1;
+
+    if(argc > 2 && strcmp(argv[1], "-i") == 0){
+        usec = atoi(argv[2]);
+        i = 3;
+    }
+    if(i >= argc){
+        fprintf(2, "Usage: prof [-i usec] program [args...]\n");
+        exit(1);
+    }
+
+    if(profctl(PROF_START, usec) < 0){
+        fprintf(2, "prof: cannot start profiler\n");
+        exit(1);
+    }
+
+    int pid = fork();
+    if(pid < 0){
+        profctl(PROF_STOP, 0);
+        fprintf(2, "prof: fork failed\n");
+        exit(1);
+    }
+    if(pid == 0){
+        exec(argv[i], &argv[i]);
+        fprintf(2, "prof: exec %s failed\n", argv[i]);
+        exit(1);
+    }
+
+    // a second child drains samples while the program runs.
+    int reader = fork();
+    if(reader == 0){
+        collect(pid, argv[i], usec);
+        exit(0);
+    }
+
+    int w;
+    while((w = wait(0)) != pid && w >= 0)
+        ;
+    profctl(PROF_STOP, 0);
+    if(reader > 0)
+        wait(0);
+    exit(0);
+}
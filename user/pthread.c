@@ -0,0 +1,85 @@
+// A minimal pthreads on top of clone() and join(); the mutexes,
+// built on futex(), are in ulib.c.
+//
+// Each thread runs on a malloc()ed stack and finds its struct
+// pthread through the tp register, which nothing else uses.
+// malloc() is not thread-safe, so threads should be created and
+// joined by one thread. printf() and the other buffered I/O in
+// printf.c lock their buffers.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define STACKSIZE (4*4096)
+
+struct pthread {
+  int tid;
+  void *(*fn)(void*);
+  void *arg;
+  void *ret;        // fn's result, for pthread_join()
+  char *stack;
+};
+
+// The first code a new thread runs, on its new stack.
+static void
+start(void *arg)
+{
+  struct pthread *t = arg;
+
+  asm volatile("mv tp, %0" : : "r" (t));
+  pthread_exit(t->fn(t->arg));
+}
+
+// Start a thread running fn(arg). Returns 0, or -1.
+int
+pthread_create(pthread_t *tp, void *(*fn)(void*), void *arg)
+{
+  struct pthread *t;
+
+  if((t = malloc(sizeof(*t))) == 0)
+    return -1;
+  if((t->stack = malloc(STACKSIZE)) == 0){
+    free(t);
+    return -1;
+  }
+  t->fn = fn;
+  t->arg = arg;
+  t->ret = 0;
+  // malloc()'s blocks are 16-byte aligned, as the ABI wants sp.
+  if((t->tid = clone(start, t, t->stack + STACKSIZE)) < 0){
+    free(t->stack);
+    free(t);
+    return -1;
+  }
+  *tp = t;
+  return 0;
+}
+
+// End the calling thread, which pthread_create() made, handing
+// ret to pthread_join(). The main thread should exit() instead,
+// which ends all the threads.
+void
+pthread_exit(void *ret)
+{
+  struct pthread *t;
+
+  asm volatile("mv %0, tp" : "=r" (t));
+  t->ret = ret;
+  // not exit(): the buffered output is the process's, and is
+  // flushed when the process exits.
+  sys_exit(0);
+}
+
+// Wait for t to finish, store what it returned in *ret if ret
+// isn't 0, and free it. Returns 0, or -1.
+int
+pthread_join(pthread_t t, void **ret)
+{
+  if(join(t->tid, 0) < 0)
+    return -1;
+  if(ret)
+    *ret = t->ret;
+  free(t->stack);
+  free(t);
+  return 0;
+}
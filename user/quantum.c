@@ -0,0 +1,26 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// Show or set the scheduling time slice, in microseconds.
+int
+main(int argc, char *argv[])
+{
+    int old;
+
+    if(argc > 2){
+        fprintf(2, "Usage: quantum [usec]\n");
+        exit(1);
+    }
+
+    old = setquantum(argc == 2 ? atoi(argv[1]) : 0);
+    if(old < 0){
+        fprintf(2, "quantum: %s out of range (100..10000000 usec)\n", argv[1]);
+        exit(1);
+    }
+
+    if(argc == 2)
+        printf("quantum: %d -> %d usec\n", old, atoi(argv[1]));
+    else
+        printf("quantum: %d usec\n", old);
+    exit(0);
+}
@@ -30,17 +30,6 @@ int alias_count = 0;
 struct history_entry history[MAX_HISTORY];
 int history_count = 0;
 
-// emulate Linux dup2 using xv6 dup()
-void dup2(int oldfd, int newfd) {
-    if (oldfd == newfd) return;
-    close(newfd);
-    int fd = dup(oldfd);
-    if (fd != newfd) {
-        fprintf(2, "dup2 failed\n");
-        exit(1);
-    }
-}
-
 // Safe string copy
 int safestrcpy(char *s, const char *t, int n) {
     int i;
@@ -193,7 +182,13 @@ int main(void) {
                "─" COLOR_GREEN "[%s]" COLOR_RESET
                "$ ", last_status, cmd_num, cwd);
 
-        if (gets(buf, sizeof(buf)) == 0) break;
+        // gets(), not fgets(): read-ahead on fd 0 would steal
+        // input meant for the commands smash runs.
+        memset(buf, 0, sizeof(buf));
+        gets(buf, sizeof(buf));
+        if (buf[0] == 0) break;  // EOF
+        int n = strlen(buf);
+        if (buf[n-1] == '\n' || buf[n-1] == '\r') buf[n-1] = 0;
         if (strlen(buf) == 0) continue;
 
         // Expand history (!)
@@ -29,31 +29,28 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // read lines
-    if (!filename) {
-        while (gets(buf, sizeof(buf)) != 0 && n < MAXLINES) {
-            strcpy(lines[n++], buf);
-        }
-    } else {
-        int fd = open(filename, 0);
+    // read lines, truncating any longer than MAXLEN-1
+    int fd = 0;
+    if (filename) {
+        fd = open(filename, 0);
         if (fd < 0) {
             fprintf(2, "sort: cannot open %s\n", filename);
             exit(1);
         }
-        int m;
-        while ((m = read(fd, buf, sizeof(buf)-1)) > 0) {
-            buf[m] = '\0';
-            char *p = buf;
-            while (*p && n < MAXLINES) {
-                char *q = strchr(p, '\n');
-                if (q) *q = '\0';
-                strcpy(lines[n++], p);
-                if (!q) break;
-                p = q + 1;
-            }
+    }
+    int m;
+    while (n < MAXLINES && (m = fgets(buf, sizeof(buf), fd)) > 0) {
+        if (buf[m-1] == '\n') {
+            buf[m-1] = '\0';
+        } else {
+            int c;
+            while ((c = getc(fd)) >= 0 && c != '\n')
+                ;
         }
-        close(fd);
+        strcpy(lines[n++], buf);
     }
+    if (filename)
+        close(fd);
 
     // simple bubble sort
     for (int i = 0; i < n; i++) {
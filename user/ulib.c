@@ -1,12 +1,14 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
 #include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "kernel/vm.h"
+#include "kernel/vdata.h"
+#include "kernel/futex.h"
 #include "user/user.h"
 
-#define NULL 0
-
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -160,70 +162,80 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
-// Reads contents of given file ('fd') to 'buf' of size 'max'.
-// 
-// Returns character's read, excluding null terminator.
+//
+// Read the kernel's read-only data pages (kernel/vdata.h)
+// instead of making system calls.
+//
+
 int
-fgets(char *buf, unsigned int max, int fd)
+ugetpid(void)
 {
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(fd, &c, 1);
-    if(cc < 1) {
-      return -1;
-    }
-    buf[i++] = c;
-    if(c == '\n' || c == '\r'){
-      break;
-    }
-  }
-
-  buf[i] = '\0';
-  return i;
+  return ((volatile struct usyscall *)USYSCALL)->pid;
 }
 
-// Like fgets, but dynamically allocates correct memory
-// to store the string.
-//
-// Caller provides pointer to a malloced 'buf' and capacity ('size').
-// 'buf' points to NULL, a new buffer is allocated. 
-// Returns characters read, excluding null terminator.
-int
-getline(char **buf, int size, int fd)
+uint
+uuptime(void)
 {
-  int chars_read = 0;
-  int curr_read;
+  return ((volatile struct vdata *)VDATA)->ticks;
+}
 
-  // initilize buffer if not already initilized  (size = 2, malloc space for a char + /0)
-  if (*buf == NULL || size < 2) {		
-    free(*buf);	// in case buf was 1 (if null, does nothing)
-    *buf = malloc(2);
-    size = 2;
-  }
+// Nanoseconds since the epoch, like rtcgettime(), from the time
+// CSR and the kernel's boot-time calibration against the RTC.
+uint64
+urtctime(void)
+{
+  volatile struct vdata *vd = (volatile struct vdata *)VDATA;
+  uint64 d = r_time() - vd->time0;
 
-  while ((curr_read = fgets(*buf + chars_read, size - chars_read, fd))) {
+  // split the division so that d * 10^9 can't overflow.
+  return vd->rtc0 + (d / vd->timebase) * 1000000000ULL +
+         (d % vd->timebase) * 1000000000ULL / vd->timebase;
+}
 
-    if (curr_read < 0) {  // error in fgets
-      return - 1;
-    }
+const struct vdata *
+vdatapage(void)
+{
+  return (const struct vdata *)VDATA;
+}
 
-    chars_read += curr_read;
+// pthread mutexes, here rather than in pthread.c because
+// printf.c locks its buffers with them, and forktest links
+// printf.o without pthread.o.
+//
+// Mutexes follow Drepper's "Futexes Are Tricky": v is 0 when
+// unlocked, 1 when locked, and 2 when locked and some thread may
+// be waiting in futex(), so that unlock only makes a system call
+// when it must.
 
-    //resize 
-    char *temp = malloc(size * 2);
-    memcpy(temp, *buf, chars_read + 1); // include null term
-    free(*buf);
-    *buf = temp;
-    size = size * 2;
+int
+pthread_mutex_init(pthread_mutex_t *m)
+{
+  m->v = 0;
+  return 0;
+}
 
-    // break if end of line/eof
-    char *last_char = *buf + (chars_read - 1);
-    if (strcmp(last_char, "\n") == 0 || strcmp(last_char, "\r") == 0) {
-      break;
-    }
+int
+pthread_mutex_lock(pthread_mutex_t *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->v, 0, 1)) == 0)
+    return 0;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while(c != 0){
+    futex((int*)&m->v, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->v, 2);
   }
+  return 0;
+}
 
-  return chars_read;
+int
+pthread_mutex_unlock(pthread_mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __sync_lock_release(&m->v);
+    futex((int*)&m->v, FUTEX_WAKE, 1);
+  }
+  return 0;
 }
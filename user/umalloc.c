@@ -2,25 +2,38 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/mman.h"
 
 #define MIN_DATA_SIZE 16
 #define ALIGN 16
 #define MIN_BLOCK_SIZE 48
 #define PAGE_SIZE 4096
 
-enum fsm_algorithm { FIRST_FIT, BEST_FIT, WORST_FIT };
+enum fsm_algorithm { FIRST_FIT, BEST_FIT, WORST_FIT, SEGREGATED };
+
+// Every allocation, whatever mode made it, is immediately
+// preceded by a uint kind, so free() and realloc() can tell
+// which allocator owns a pointer after malloc_setfsm() switches
+// modes.
+#define KIND_LIST     0x4c495354    // struct mem_block
+#define KIND_SEG      0x53454721    // segregated-fit block
+#define KIND_SLAB     0x534c4142    // slab object in use
+#define KIND_SLABFREE 0x534c4146    // slab object on its slab's free list
+#define KIND_MMAP     0x4d4d4150    // large block with its own mapping
 
 struct mem_block {
     char name[8];
-    uint size;                  // low bit = free flag
     struct mem_block *next_block;
     struct mem_block *prev_block;
+    uint size;                  // low bit = free flag
+    uint kind;                  // KIND_LIST
 };
 
 static struct mem_block *head = 0;
+static struct mem_block *tail = 0;
 static struct mem_block *free_list = 0;
 static int scribble_enabled = 0;
-static enum fsm_algorithm current_fsm = FIRST_FIT;
+static enum fsm_algorithm current_fsm = SEGREGATED;
 
 // Helpers
 
@@ -33,6 +46,13 @@ static void set_free(struct mem_block *b) { b->size |= 0x01; }
 static int is_free(struct mem_block *b) { return (b->size & 0x01) != 0; }
 static uint get_size(struct mem_block *b) { return b->size & ~0x01; }
 
+// Blocks are chained in address order, but sbrk() chunks are only
+// physically adjacent if nothing else (the segregated allocator,
+// or the program itself) moved the break in between.
+static int adjacent(struct mem_block *a, struct mem_block *b) {
+    return (char *)(a + 1) + get_size(a) == (char *)b;
+}
+
 static void set_free_next(struct mem_block *b, struct mem_block *next) {
     struct mem_block **p = (struct mem_block **)(b + 1);
     *p = next;
@@ -50,7 +70,7 @@ static void add_to_free_list(struct mem_block *b) {
         return;
     }
 
-    if (current_fsm == FIRST_FIT) {
+    if (current_fsm == FIRST_FIT || current_fsm == SEGREGATED) {
         set_free_next(b, free_list);
         free_list = b;
     } else { // BEST or WORST FIT
@@ -82,7 +102,7 @@ static void remove_from_free_list(struct mem_block *b) {
 static void coalesce(struct mem_block *b) {
     remove_from_free_list(b);
 
-    if (b->prev_block && is_free(b->prev_block)) {
+    if (b->prev_block && is_free(b->prev_block) && adjacent(b->prev_block, b)) {
         struct mem_block *prev = b->prev_block;
         remove_from_free_list(prev);
         uint new_data = get_size(prev) + sizeof(struct mem_block) + get_size(b);
@@ -90,10 +110,12 @@ static void coalesce(struct mem_block *b) {
         prev->next_block = b->next_block;
         if (b->next_block)
             b->next_block->prev_block = prev;
+        else
+            tail = prev;
         b = prev;
     }
 
-    if (b->next_block && is_free(b->next_block)) {
+    if (b->next_block && is_free(b->next_block) && adjacent(b, b->next_block)) {
         struct mem_block *next = b->next_block;
         remove_from_free_list(next);
         uint new_data = get_size(b) + sizeof(struct mem_block) + get_size(next);
@@ -101,6 +123,8 @@ static void coalesce(struct mem_block *b) {
         b->next_block = next->next_block;
         if (next->next_block)
             next->next_block->prev_block = b;
+        else
+            tail = b;
     }
 
     add_to_free_list(b);
@@ -116,6 +140,7 @@ static struct mem_block *find_free_block(uint size) {
         if (get_size(cur) >= size) {
             switch (current_fsm) {
                 case FIRST_FIT:
+                case SEGREGATED:
                     return cur;
                 case BEST_FIT:
                     if (!best || get_size(cur) < get_size(best))
@@ -144,10 +169,14 @@ static void split_block(struct mem_block *b, uint size) {
 
     uint new_data = bsize - size - sizeof(struct mem_block);
     newb->size = new_data | 0x01;  // free
+    newb->kind = KIND_LIST;
+    newb->name[0] = '\0';
     newb->prev_block = b;
     newb->next_block = b->next_block;
     if (b->next_block)
         b->next_block->prev_block = newb;
+    else
+        tail = newb;
     b->next_block = newb;
 
     b->size = size & ~0x01;  // allocated block
@@ -155,11 +184,402 @@ static void split_block(struct mem_block *b, uint size) {
     add_to_free_list(newb);  // tail insertion
 }
 
-// malloc/free/calloc/realloc
+// Segregated fit
+//
+// The default mode. Requests of up to SLAB_MAX bytes come from
+// slabs: blocks of PAGE_SIZE bytes cut into objects of a single
+// size class, each slab with its own free list, so a small
+// malloc() or free() is a pointer pop or push. Larger requests
+// get boundary-tagged blocks from arenas grown with sbrk(). A
+// block starts with its size and in-use bits, and a free block
+// also ends with its size. So free() can find and merge both
+// neighbours in O(1), without walking any list. Free blocks sit
+// in NBINS bins: exact 16-byte classes up to 512 bytes, then one
+// bin per power of two. A bitmap of non-empty bins finds the
+// smallest bin that can satisfy a request without a scan.
+//
+// Requests of MMAP_MIN bytes or more get a mapping of their own
+// where mmap() allows it, so freeing them returns the memory at
+// once. When free space at the top of the heap passes TRIM_MIN,
+// free() hands it back with a negative sbrk().
+
+struct tag {
+    uint word;      // SEG: block size | flags; SLAB: offset of the tag in its slab
+    uint kind;
+};
 
-void *malloc(uint size) {
-    if (size == 0) return 0;
+#define SEG_INUSE     0x1
+#define SEG_PREVINUSE 0x2
+#define SEG_SLAB      0x4           // the block holds a slab
+#define SEG_FLAGS     0xf
+#define SEG_MIN       32            // tag, free list links and footer
+#define SEG_ARENA     (64 * 1024)   // least to take from sbrk at once
+#define SEG_MAX       0x40000000
+#define MMAP_MIN      (128 * 1024)
+#define TRIM_MIN      (128 * 1024)  // trim the heap top when this much is free
+#define TRIM_KEEP     SEG_ARENA     // and leave this much
+#define NEXACT        32            // bins 0..31 hold sizes 16..512
+#define NBINS         48
+
+struct seg_free {
+    struct tag tag;
+    struct seg_free *next;
+    struct seg_free *prev;
+};
+
+// An arena is [struct arena][pad][blocks...][epilogue tag]. The
+// epilogue is a zero-sized in-use block, so merging stops there.
+struct arena {
+    struct arena *next;
+    char *end;
+};
+
+#define ARENA_FIRST   (sizeof(struct arena) + 8)   // first block, 8 mod 16
+
+static struct arena *arenas = 0;    // newest first
+static struct seg_free *bins[NBINS];
+static uint64 binmap;
+
+static struct tag *tag_of(void *ptr) { return (struct tag *)ptr - 1; }
+static uint seg_size(struct tag *t) { return t->word & ~SEG_FLAGS; }
+static struct tag *seg_next(struct tag *t) { return (struct tag *)((char *)t + seg_size(t)); }
+
+static void set_footer(struct tag *t) {
+    *(uint64 *)((char *)t + seg_size(t) - 8) = seg_size(t);
+}
+
+static int bin_of(uint size) {
+    if (size <= 16 * NEXACT)
+        return size / 16 - 1;
+    int b = NEXACT;
+    for (uint s = 2 * 16 * NEXACT; s <= size && b < NBINS - 1; s <<= 1)
+        b++;
+    return b;
+}
+
+static void bin_insert(struct tag *t) {
+    struct seg_free *f = (struct seg_free *)t;
+    int b = bin_of(seg_size(t));
+    f->prev = 0;
+    f->next = bins[b];
+    if (f->next)
+        f->next->prev = f;
+    bins[b] = f;
+    binmap |= 1ULL << b;
+}
+
+static void bin_remove(struct tag *t) {
+    struct seg_free *f = (struct seg_free *)t;
+    int b = bin_of(seg_size(t));
+    if (f->prev)
+        f->prev->next = f->next;
+    else
+        bins[b] = f->next;
+    if (f->next)
+        f->next->prev = f->prev;
+    if (!bins[b])
+        binmap &= ~(1ULL << b);
+}
+
+// Find a free block of at least size bytes. Only the requested
+// bin is searched; every block in a higher non-empty bin fits.
+static struct tag *seg_find(uint size) {
+    int b = bin_of(size);
+    if (b >= NEXACT) {
+        for (struct seg_free *f = bins[b]; f; f = f->next)
+            if (seg_size(&f->tag) >= size)
+                return &f->tag;
+        b++;
+    }
+    uint64 m = binmap >> b;
+    if (m == 0)
+        return 0;
+    while (!(m & 1)) {
+        m >>= 1;
+        b++;
+    }
+    return &bins[b]->tag;
+}
+
+// Free block t, merging it with free neighbours.
+static void seg_release(struct tag *t) {
+    uint size = seg_size(t);
+    uint prevuse = t->word & SEG_PREVINUSE;
+    struct tag *next = seg_next(t);
+
+    if (!prevuse) {
+        uint psize = *(uint64 *)((char *)t - 8);
+        t = (struct tag *)((char *)t - psize);
+        bin_remove(t);
+        size += psize;
+        prevuse = t->word & SEG_PREVINUSE;
+    }
+    if (!(next->word & SEG_INUSE)) {
+        bin_remove(next);
+        size += seg_size(next);
+    }
+    t->word = size | prevuse;
+    t->kind = KIND_SEG;
+    set_footer(t);
+    seg_next(t)->word &= ~SEG_PREVINUSE;
+    bin_insert(t);
+}
+
+// Mark t, a block of avail bytes that is in no bin, in use with
+// size need, and free whatever remainder is big enough.
+static void seg_use(struct tag *t, uint avail, uint need) {
+    uint prevuse = t->word & SEG_PREVINUSE;
+
+    if (avail - need >= SEG_MIN) {
+        struct tag *rest = (struct tag *)((char *)t + need);
+        rest->word = (avail - need) | SEG_PREVINUSE;
+        rest->kind = KIND_SEG;
+        set_footer(rest);
+        bin_insert(rest);
+        seg_next(rest)->word &= ~SEG_PREVINUSE;
+        avail = need;
+    }
+    t->word = avail | SEG_INUSE | prevuse;
+    t->kind = KIND_SEG;
+    seg_next(t)->word |= SEG_PREVINUSE;
+}
+
+// Get at least need more bytes of free block from sbrk(),
+// extending the newest arena if the break hasn't moved since.
+static int seg_grow(uint need) {
+    char *brk = sbrk(0);
+    struct arena *a = arenas;
+    uint n;
+
+    if (a && a->end == brk) {
+        n = need < SEG_ARENA ? SEG_ARENA : need;
+        n = (n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        if (sbrk(n) != brk)
+            return -1;
+        // the old epilogue becomes the new block's tag.
+        struct tag *t = (struct tag *)(brk - sizeof(struct tag));
+        t->word = n | (t->word & SEG_PREVINUSE);
+        a->end = brk + n;
+        struct tag *epi = (struct tag *)(a->end - sizeof(struct tag));
+        epi->word = SEG_INUSE;
+        epi->kind = KIND_SEG;
+        seg_release(t);
+        return 0;
+    }
+
+    n = need + ARENA_FIRST + sizeof(struct tag);
+    n = n < SEG_ARENA ? SEG_ARENA : n;
+    n = (n + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint pad = (16 - (uint64)brk % 16) % 16;
+    char *p = sbrk(n + pad);
+    if (p == (char *)-1)
+        return -1;
+    a = (struct arena *)(p + pad);
+    a->next = arenas;
+    a->end = (char *)a + n;
+    arenas = a;
+    struct tag *t = (struct tag *)((char *)a + ARENA_FIRST);
+    t->word = (n - ARENA_FIRST - sizeof(struct tag)) | SEG_PREVINUSE;
+    struct tag *epi = (struct tag *)(a->end - sizeof(struct tag));
+    epi->word = SEG_INUSE;
+    epi->kind = KIND_SEG;
+    seg_release(t);
+    return 0;
+}
+
+// Give back all but TRIM_KEEP bytes of a large free block at the
+// top of the heap.
+static void seg_trim(void) {
+    struct arena *a = arenas;
+    if (!a)
+        return;
+    struct tag *epi = (struct tag *)(a->end - sizeof(struct tag));
+    if (epi->word & SEG_PREVINUSE)
+        return;
+    struct tag *t = (struct tag *)((char *)epi - *(uint64 *)((char *)epi - 8));
+    if (seg_size(t) < TRIM_MIN + TRIM_KEEP || sbrk(0) != a->end)
+        return;
+    uint excess = (seg_size(t) - TRIM_KEEP) & ~(PAGE_SIZE - 1);
+    bin_remove(t);
+    t->word -= excess;
+    set_footer(t);
+    epi = seg_next(t);
+    epi->word = SEG_INUSE;
+    epi->kind = KIND_SEG;
+    bin_insert(t);
+    a->end -= excess;
+    sbrk(-(int)excess);
+}
+
+// Large blocks with a mapping of their own, chained so that
+// malloc_leaks() can find them.
+struct big {
+    struct big *next;
+    struct big *prev;
+    uint64 pad;
+    struct tag tag;         // word: length of the mapping
+};
+
+static struct big *bigs = 0;
+
+static void *big_malloc(uint n) {
+    if (n >= SEG_MAX)
+        return 0;
+    uint len = (n + sizeof(struct big) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    struct big *b = (struct big *)mmap(0, len, PROT_READ | PROT_WRITE,
+                                       MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (b == (struct big *)-1)
+        return 0;
+    b->tag.word = len;
+    b->tag.kind = KIND_MMAP;
+    b->prev = 0;
+    b->next = bigs;
+    if (bigs)
+        bigs->prev = b;
+    bigs = b;
+    return b + 1;
+}
+
+static void big_free(struct tag *t) {
+    struct big *b = (struct big *)(t + 1) - 1;
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        bigs = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    munmap((uint64)b, b->tag.word);
+}
+
+static uint seg_block_size(uint n) {
+    uint size = (n + sizeof(struct tag) + 15) & ~15;
+    return size < SEG_MIN ? SEG_MIN : size;
+}
+
+static void *seg_malloc(uint n) {
+    if (n >= SEG_MAX)
+        return 0;
+    uint size = seg_block_size(n);
+    struct tag *t = seg_find(size);
+    if (!t) {
+        if (seg_grow(size) < 0 || !(t = seg_find(size)))
+            return 0;
+    }
+    bin_remove(t);
+    seg_use(t, seg_size(t), size);
+    return t + 1;
+}
+
+// Slabs
+
+#define NCLASS   7
+#define SLAB_MAX 248
+
+// object sizes are 8 mod 16, so that with their tag each one
+// keeps the next 16-byte aligned.
+static uint slab_class[NCLASS] = { 24, 40, 56, 88, 120, 184, 248 };
+
+struct slab {
+    struct slab *next;      // partial slabs of this class
+    struct slab *prev;
+    struct tag *free;       // free objects
+    ushort cls;
+    ushort nfree;
+    ushort nobj;
+};
+
+#define SLAB_FIRST  (((sizeof(struct slab) + 15) & ~15) + 8)
 
+static struct slab *partial[NCLASS];
+
+static struct tag **obj_next(struct tag *t) { return (struct tag **)(t + 1); }
+static struct slab *slab_of(struct tag *t) { return (struct slab *)((char *)t - t->word); }
+
+static void slab_link(struct slab *s) {
+    s->prev = 0;
+    s->next = partial[s->cls];
+    if (s->next)
+        s->next->prev = s;
+    partial[s->cls] = s;
+}
+
+static void slab_unlink(struct slab *s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        partial[s->cls] = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+}
+
+static struct slab *slab_new(int cls) {
+    struct slab *s = seg_malloc(PAGE_SIZE);
+    if (!s)
+        return 0;
+    tag_of(s)->word |= SEG_SLAB;
+    uint stride = slab_class[cls] + sizeof(struct tag);
+    s->cls = cls;
+    s->nobj = (PAGE_SIZE - SLAB_FIRST) / stride;
+    s->nfree = s->nobj;
+    s->free = 0;
+    for (int i = s->nobj - 1; i >= 0; i--) {
+        struct tag *t = (struct tag *)((char *)s + SLAB_FIRST + i * stride);
+        t->word = (char *)t - (char *)s;
+        t->kind = KIND_SLABFREE;
+        *obj_next(t) = s->free;
+        s->free = t;
+    }
+    slab_link(s);
+    return s;
+}
+
+static void *slab_malloc(uint n) {
+    int cls = 0;
+    while (slab_class[cls] < n)
+        cls++;
+    struct slab *s = partial[cls];
+    if (!s && !(s = slab_new(cls)))
+        return 0;
+    struct tag *t = s->free;
+    s->free = *obj_next(t);
+    t->kind = KIND_SLAB;
+    if (--s->nfree == 0)
+        slab_unlink(s);
+    return t + 1;
+}
+
+static void slab_free(struct tag *t) {
+    struct slab *s = slab_of(t);
+    *obj_next(t) = s->free;
+    s->free = t;
+    t->kind = KIND_SLABFREE;
+    if (s->nfree++ == 0)
+        slab_link(s);
+    // keep one empty slab per class, to avoid thrashing.
+    if (s->nfree == s->nobj && (partial[s->cls] != s || s->next)) {
+        slab_unlink(s);
+        seg_release(tag_of(s));
+    }
+}
+
+// Bytes usable at ptr.
+static uint usable(void *ptr) {
+    struct tag *t = tag_of(ptr);
+    switch (t->kind) {
+        case KIND_LIST:
+            return get_size((struct mem_block *)ptr - 1);
+        case KIND_SEG:
+            return seg_size(t) - sizeof(struct tag);
+        case KIND_MMAP:
+            return t->word - sizeof(struct big);
+        default:
+            return slab_class[slab_of(t)->cls];
+    }
+}
+
+// malloc/free/calloc/realloc
+
+static void *list_malloc(uint size) {
     size = align_size(size);
     if (size < MIN_DATA_SIZE) size = MIN_DATA_SIZE;
 
@@ -168,8 +588,6 @@ void *malloc(uint size) {
         remove_from_free_list(b);
         split_block(b, size);
         set_used(b);
-        if (scribble_enabled)
-            memset(b + 1, 0xAA, get_size(b));
         return (void *)(b + 1);
     }
 
@@ -181,34 +599,61 @@ void *malloc(uint size) {
     if (newb == (void *)-1) return 0;
 
     newb->size = (request - sizeof(struct mem_block)) & ~0x01;
-    newb->prev_block = 0;
+    newb->kind = KIND_LIST;
+    newb->prev_block = tail;
     newb->next_block = 0;
     newb->name[0] = '\0';
 
     if (!head)
         head = newb;
-    else {
-        struct mem_block *tmp = head;
-        while (tmp->next_block)
-            tmp = tmp->next_block;
-        tmp->next_block = newb;
-        newb->prev_block = tmp;
-    }
+    else
+        tail->next_block = newb;
+    tail = newb;
 
     split_block(newb, size);
     set_used(newb);
-    if (scribble_enabled)
-        memset(newb + 1, 0xAA, get_size(newb));
-
     return (void *)(newb + 1);
 }
 
+void *malloc(uint size) {
+    if (size == 0) return 0;
+
+    void *p;
+    if (current_fsm != SEGREGATED)
+        p = list_malloc(size);
+    else if (size <= SLAB_MAX)
+        p = slab_malloc(size);
+    else if (size < MMAP_MIN || (p = big_malloc(size)) == 0)
+        p = seg_malloc(size);
+    if (p && scribble_enabled)
+        memset(p, 0xAA, usable(p));
+    return p;
+}
+
 void free(void *ptr) {
     if (!ptr) return;
-    struct mem_block *b = (struct mem_block *)ptr - 1;
-    set_free(b);
-    add_to_free_list(b);
-    coalesce(b);
+    struct tag *t = tag_of(ptr);
+    switch (t->kind) {
+        case KIND_LIST: {
+            struct mem_block *b = (struct mem_block *)ptr - 1;
+            set_free(b);
+            add_to_free_list(b);
+            coalesce(b);
+            break;
+        }
+        case KIND_SEG:
+            seg_release(t);
+            seg_trim();
+            break;
+        case KIND_SLAB:
+            slab_free(t);
+            break;
+        case KIND_MMAP:
+            big_free(t);
+            break;
+        default:
+            fprintf(2, "free: bad pointer %p\n", ptr);
+    }
 }
 
 void *calloc(uint nmemb, uint size) {
@@ -219,10 +664,7 @@ void *calloc(uint nmemb, uint size) {
     return p;
 }
 
-void *realloc(void *ptr, uint size) {
-    if (!ptr) return malloc(size);
-    if (size == 0) { free(ptr); return 0; }
-
+static void *list_realloc(void *ptr, uint size) {
     size = align_size(size);
     if (size < MIN_DATA_SIZE) size = MIN_DATA_SIZE;
 
@@ -234,7 +676,7 @@ void *realloc(void *ptr, uint size) {
         return ptr;
     }
 
-    if (b->next_block && is_free(b->next_block)) {
+    if (b->next_block && is_free(b->next_block) && adjacent(b, b->next_block)) {
         struct mem_block *next = b->next_block;
         uint combined = old + sizeof(struct mem_block) + get_size(next);
         if (combined >= size) {
@@ -243,6 +685,8 @@ void *realloc(void *ptr, uint size) {
             b->next_block = next->next_block;
             if (next->next_block)
                 next->next_block->prev_block = b;
+            else
+                tail = b;
             split_block(b, size);
             set_used(b);
             if (scribble_enabled) {
@@ -254,8 +698,37 @@ void *realloc(void *ptr, uint size) {
             return ptr;
         }
     }
+    return 0;
+}
+
+void *realloc(void *ptr, uint size) {
+    if (!ptr) return malloc(size);
+    if (size == 0) { free(ptr); return 0; }
+
+    struct tag *t = tag_of(ptr);
+    uint old = usable(ptr);
+    void *newp;
+
+    if (t->kind == KIND_LIST) {
+        if ((newp = list_realloc(ptr, size)) != 0)
+            return newp;
+    } else if (size <= old) {
+        return ptr;
+    } else if (t->kind == KIND_SEG && size < SEG_MAX) {
+        // grow into a free successor if that's enough.
+        uint need = seg_block_size(size);
+        struct tag *next = seg_next(t);
+        uint avail = seg_size(t) + seg_size(next);
+        if (!(next->word & SEG_INUSE) && avail >= need) {
+            bin_remove(next);
+            seg_use(t, avail, need);
+            if (scribble_enabled)
+                memset((char *)ptr + old, 0xAA, usable(ptr) - old);
+            return ptr;
+        }
+    }
 
-    void *newp = malloc(size);
+    newp = malloc(size);
     if (!newp) return 0;
     memmove(newp, ptr, old);
     free(ptr);
@@ -265,10 +738,44 @@ void *realloc(void *ptr, uint size) {
 // Scribble and FSM
 
 void malloc_scribble(int enable) { scribble_enabled = enable ? 1 : 0; }
-void malloc_setfsm(int algo) { if (algo >= 0 && algo <= 2) current_fsm = (enum fsm_algorithm)algo; }
+void malloc_setfsm(int algo) { if (algo >= FIRST_FIT && algo <= SEGREGATED) current_fsm = (enum fsm_algorithm)algo; }
 
 // Debug/Leak
 
+// Call fn on every allocation in the segregated arenas,
+// descending into slabs.
+static void seg_walk(void (*fn)(void *, uint, int)) {
+    for (struct arena *a = arenas; a; a = a->next) {
+        struct tag *t = (struct tag *)((char *)a + ARENA_FIRST);
+        for (; seg_size(t) != 0; t = seg_next(t)) {
+            if (!(t->word & SEG_SLAB)) {
+                fn(t + 1, seg_size(t) - sizeof(struct tag), t->word & SEG_INUSE);
+                continue;
+            }
+            struct slab *s = (struct slab *)(t + 1);
+            uint stride = slab_class[s->cls] + sizeof(struct tag);
+            for (int i = 0; i < s->nobj; i++) {
+                struct tag *o = (struct tag *)((char *)s + SLAB_FIRST + i * stride);
+                fn(o + 1, slab_class[s->cls], o->kind == KIND_SLAB);
+            }
+        }
+    }
+}
+
+static void print_seg(void *p, uint size, int used) {
+    printf("[SEG %p] %d [%s]\n", p, size, used ? "USED" : "FREE");
+}
+
+static int leak_blocks, leak_bytes;
+
+static void leak_seg(void *p, uint size, int used) {
+    if (!used)
+        return;
+    printf("[SEG %p] %d\n", p, size);
+    leak_blocks++;
+    leak_bytes += size;
+}
+
 void malloc_print(void) {
     struct mem_block *b = head;
     printf("-- Current Memory State --\n");
@@ -281,6 +788,9 @@ void malloc_print(void) {
                b->name[0] ? b->name : "");
         b = b->next_block;
     }
+    seg_walk(print_seg);
+    for (struct big *g = bigs; g; g = g->next)
+        printf("[MMAP %p] %d [USED]\n", (void *)(g + 1), usable(g + 1));
 
     printf("\n-- Free List --\n");
     struct mem_block *f = free_list;
@@ -294,17 +804,19 @@ void malloc_print(void) {
 
 void malloc_leaks(void) {
     struct mem_block *b = head;
-    int blocks = 0, bytes = 0;
+    leak_blocks = leak_bytes = 0;
     printf("-- Leak Check --\n");
     while (b) {
         if (!is_free(b)) {
             printf("[BLOCK %p] %d '%s'\n", (void *)b, get_size(b), b->name[0] ? b->name : "");
-            blocks++;
-            bytes += get_size(b);
+            leak_blocks++;
+            leak_bytes += get_size(b);
         }
         b = b->next_block;
     }
+    seg_walk(leak_seg);
+    for (struct big *g = bigs; g; g = g->next)
+        leak_seg(g + 1, usable(g + 1), 1);
     printf("-- Summary --\n");
-    printf("%d blocks lost (%d bytes)\n", blocks, bytes);
+    printf("%d blocks lost (%d bytes)\n", leak_blocks, leak_bytes);
 }
-
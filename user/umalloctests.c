@@ -8,6 +8,83 @@ void print_result(int cond, char *msg) {
     else      printf("FAIL: %s\n", msg);
 }
 
+// Benchmark: the same pseudo-random mix of malloc(), free() and
+// realloc() under each mode, in a child so that every mode starts
+// from the same heap. Reports throughput and utilization: the
+// peak bytes the program had allocated over the bytes the heap
+// grew by.
+
+#define BENCH_SLOTS 512
+#define BENCH_OPS   20000
+
+static uint bench_seed;
+
+static uint bench_rand(void) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 16) & 0x7fff;
+}
+
+static uint bench_size(void) {
+    uint r = bench_rand() % 100;
+    if (r < 80) return 1 + bench_rand() % 256;
+    if (r < 95) return 256 + bench_rand() % 1792;
+    return 2048 + bench_rand() % 14336;
+}
+
+static void bench(int fsm, char *name) {
+    static char *slot[BENCH_SLOTS];
+    static uint size[BENCH_SLOTS];
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("FAIL: fork\n");
+        return;
+    }
+    if (pid > 0) {
+        wait(0);
+        return;
+    }
+
+    malloc_setfsm(fsm);
+    bench_seed = 1;
+    char *base = sbrk(0);
+    uint live = 0, peak = 0;
+    uint64 t0 = urtctime();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        int k = bench_rand() % BENCH_SLOTS;
+        if (slot[k] == 0) {
+            size[k] = bench_size();
+            if ((slot[k] = malloc(size[k])) == 0) {
+                printf("FAIL: %s: out of memory\n", name);
+                exit(1);
+            }
+            slot[k][0] = 1;
+            live += size[k];
+        } else if (bench_rand() % 4 == 0) {
+            uint n = bench_size();
+            if ((slot[k] = realloc(slot[k], n)) == 0) {
+                printf("FAIL: %s: out of memory\n", name);
+                exit(1);
+            }
+            live += n - size[k];
+            size[k] = n;
+        } else {
+            free(slot[k]);
+            slot[k] = 0;
+            live -= size[k];
+        }
+        if (live > peak)
+            peak = live;
+    }
+    uint64 t1 = urtctime();
+    uint heap = sbrk(0) - base;
+    uint64 us = (t1 - t0) / 1000;
+    printf("%s\t%lu\t\t%d\t%d\t%d%%\n", name,
+           us ? (uint64)BENCH_OPS * 1000 / us : 0,
+           heap / 1024, peak / 1024, heap ? (int)((uint64)peak * 100 / heap) : 0);
+    exit(0);
+}
+
 int main() {
 
     printf("\n===== BASIC MALLOC/FREE TESTS =====\n");
@@ -122,6 +199,120 @@ int main() {
     free(L2);
 
 
+    printf("\n===== LARGE ALLOCATION TEST =====\n");
+    malloc_setfsm(3); // SEGREGATED
+    char *brk0 = sbrk(0);
+    char *big = malloc(1024 * 1024);
+    print_result(big != 0, "malloc(1MB) returns non-null");
+    big[0] = 'a';
+    big[1024 * 1024 - 1] = 'z';
+    print_result(big[0] == 'a' && big[1024 * 1024 - 1] == 'z', "1MB block is writable");
+    free(big);
+    print_result((char *)sbrk(0) - brk0 < 256 * 1024, "free(1MB) gave the memory back");
+
+
+    printf("\n===== SEGREGATED FIT TESTS =====\n");
+    malloc_setfsm(3); // SEGREGATED
+
+    // small blocks come back from their own size class.
+    char *k1 = malloc(40);
+    char *k2 = malloc(100);
+    free(k1);
+    char *k3 = malloc(33);
+    print_result(k3 == k1, "freed block reused from its size class");
+    char *k4 = malloc(100);
+    print_result(k4 != k1, "other size class doesn't take it");
+    free(k2);
+    free(k3);
+    free(k4);
+
+    // three neighbouring large blocks merge when freed, in any
+    // order, and the merged block splits again.
+    char *g1 = malloc(1000);
+    char *g2 = malloc(1000);
+    char *g3 = malloc(1000);
+    char *guard = malloc(1000);
+    print_result(g2 == g1 + 1008 && g3 == g2 + 1008, "large blocks are contiguous");
+    free(g1);
+    free(g3);
+    free(g2);
+    char *g4 = malloc(2900);
+    print_result(g4 == g1, "freed neighbours coalesced");
+    free(g4);
+    char *g5 = malloc(2000);
+    char *g6 = malloc(900);
+    print_result(g5 == g1 && g6 == g1 + 2016, "coalesced block split for reuse");
+    free(g5);
+    free(g6);
+    free(guard);
+
+    // realloc keeps the data whether it grows in place, moves,
+    // changes size class, or shrinks.
+    char *p = malloc(600);
+    for (int i = 0; i < 600; i++)
+        p[i] = i % 251;
+    p = realloc(p, 5000);
+    int same = p != 0;
+    for (int i = 0; same && i < 600; i++)
+        if (p[i] != (char)(i % 251)) same = 0;
+    print_result(same, "realloc grow keeps data");
+    p = realloc(p, 300);
+    for (int i = 0; same && i < 300; i++)
+        if (p[i] != (char)(i % 251)) same = 0;
+    print_result(same, "realloc shrink keeps data");
+    free(p);
+
+    // across size classes: a slab object grows into a larger
+    // class, and into an arena block, and a large block shrinks.
+    char *q = malloc(20);
+    strcpy(q, "slab object");
+    q = realloc(q, 200);
+    print_result(q && strcmp(q, "slab object") == 0, "realloc to a larger size class");
+    q = realloc(q, 2000);
+    print_result(q && strcmp(q, "slab object") == 0, "realloc from slab to arena");
+    free(q);
+    char *h = malloc(200 * 1024);
+    strcpy(h, "mapped block");
+    h = realloc(h, 300 * 1024);
+    print_result(h && strcmp(h, "mapped block") == 0, "realloc of a mapped block");
+    char *h2 = realloc(h, 50);
+    print_result(h2 && strcmp(h2, "mapped block") == 0, "realloc mapped block to small");
+    free(h2);
+
+    // switching modes: each pointer goes back to the allocator
+    // that made it.
+    malloc_setfsm(0); // FIRST FIT
+    char *f1 = malloc(100);
+    strcpy(f1, "first fit");
+    malloc_setfsm(3);
+    char *f2 = malloc(100);
+    strcpy(f2, "segregated");
+    f1 = realloc(f1, 150);
+    print_result(f1 && strcmp(f1, "first fit") == 0, "realloc first-fit block in segregated mode");
+    free(f1);
+    malloc_setfsm(0);
+    f2 = realloc(f2, 150);
+    print_result(f2 && strcmp(f2, "segregated") == 0, "realloc segregated block in first-fit mode");
+    free(f2);
+    malloc_setfsm(3);
+    char *f3 = malloc(40);
+    malloc_setfsm(0);
+    free(f3);
+    malloc_setfsm(3);
+    char *f4 = malloc(40);
+    print_result(f4 == f3, "block freed in first-fit mode goes back to its size class");
+    free(f4);
+
+
+    printf("\n===== BENCHMARK =====\n");
+    printf("%d ops over %d slots\n", BENCH_OPS, BENCH_SLOTS);
+    printf("mode\t\tops/ms\t\theap KB\tpeak KB\tutil\n");
+    bench(0, "first-fit");
+    bench(1, "best-fit");
+    bench(2, "worst-fit");
+    bench(3, "segregated");
+
+
     printf("\n===== ALL TESTS COMPLETE =====\n");
     exit(0);
 }
@@ -0,0 +1,113 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/uring.h"
+#include "user/user.h"
+
+// uringbench [records]
+//
+// Write records 16-byte records to a file, one write() system
+// call each, then again as batches of URING_WRITE operations
+// submitted through uring_enter(), and compare.
+
+#define RECSZ 16
+
+static struct uring *ring;
+static char rec[RECSZ] = "0123456789abcde\n";
+
+// Check and consume all posted completions.
+static void
+reap(void)
+{
+  while(ring->cq_head != ring->cq_tail){
+    struct uring_cqe *c = &ring->cq[ring->cq_head % URING_ENTRIES];
+    if(c->res != RECSZ){
+      fprintf(2, "uringbench: write %d returned %d\n", (int)c->user_data, c->res);
+      exit(1);
+    }
+    ring->cq_head++;
+  }
+}
+
+// Queue a write of one record, submitting the ring first if
+// it is full. Returns the number of uring_enter() calls made.
+static int
+queue(int fd, int i)
+{
+  int traps = 0;
+
+  if(ring->sq_tail - ring->sq_head == URING_ENTRIES){
+    // with the completion queue empty, all entries can run.
+    reap();
+    if(uring_enter(ring, URING_ENTRIES) < 0){
+      fprintf(2, "uringbench: uring_enter failed\n");
+      exit(1);
+    }
+    traps++;
+  }
+  struct uring_sqe *e = &ring->sq[ring->sq_tail % URING_ENTRIES];
+  e->op = URING_WRITE;
+  e->fd = fd;
+  e->addr = (uint64)rec;
+  e->len = RECSZ;
+  e->user_data = i;
+  ring->sq_tail++;
+  return traps;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 2000, fd, i, traps;
+  uint64 t0, t1;
+  struct stat st;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "Usage: uringbench [records]\n");
+    exit(1);
+  }
+  if((ring = uring_setup()) == (struct uring*)-1){
+    fprintf(2, "uringbench: uring_setup failed\n");
+    exit(1);
+  }
+
+  fd = open("uringbench.out", O_CREATE|O_WRONLY|O_TRUNC);
+  t0 = rtcgettime();
+  for(i = 0; i < n; i++){
+    if(write(fd, rec, RECSZ) != RECSZ){
+      fprintf(2, "uringbench: write failed\n");
+      exit(1);
+    }
+  }
+  t1 = rtcgettime();
+  close(fd);
+  printf("write():       %d traps, %lu ms\n", n, (t1 - t0) / 1000000);
+
+  fd = open("uringbench.out", O_CREATE|O_WRONLY|O_TRUNC);
+  traps = 0;
+  t0 = rtcgettime();
+  for(i = 0; i < n; i++){
+    traps += queue(fd, i);
+  }
+  while(ring->sq_head != ring->sq_tail){
+    reap();
+    if(uring_enter(ring, ring->sq_tail - ring->sq_head) < 0){
+      fprintf(2, "uringbench: uring_enter failed\n");
+      exit(1);
+    }
+    traps++;
+  }
+  reap();
+  t1 = rtcgettime();
+  close(fd);
+  printf("uring_enter(): %d traps, %lu ms\n", traps, (t1 - t0) / 1000000);
+
+  if(stat("uringbench.out", &st) < 0 || st.size != n * RECSZ){
+    fprintf(2, "uringbench: output has the wrong size\n");
+    exit(1);
+  }
+  unlink("uringbench.out");
+  exit(0);
+}
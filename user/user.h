@@ -1,6 +1,16 @@
 #define SBRK_ERROR ((char *)-1)
 
 struct stat;
+struct rusage;
+struct profsample;
+struct lockstat;
+struct lockbench;
+struct kmemstat;
+struct slabstat;
+struct iovec;
+struct uring;
+struct vdata;
+struct pthread;
 
 // system calls
 int fork(void);
@@ -23,6 +33,12 @@ int dup(int fd);
 void dup2(int oldfd, int newfd);
 int getpid(void);
 char* sys_sbrk(int increment, int type);
+int sys_fork(void);
+int sys_exit(int) __attribute__((noreturn));
+int sys_exec(const char*, char**);
+int sys_write(int, const void*, int);
+int sys_close(int);
+int sys_uring_enter(struct uring*, int);
 int pause(int ticks);
 int uptime(void);
 int shutdown(void);
@@ -31,6 +47,25 @@ uint64 rtcgettime(void);
 int strace_on(void);
 int wait2(int *status, int *syscall_count);
 int getcwd(char *buf, int size);
+int cpuidle(uint64 *idle, int n);
+int nanosleep(uint64 nsec);
+int setquantum(int usec);
+int wait3(int *status, struct rusage *ru);
+int getrusage(int who, struct rusage *ru);
+int profctl(int cmd, int usec);
+int profread(struct profsample *buf, int n);
+int lockstat(struct lockstat *buf, int n);
+int lockbench(int kind, int n, struct lockbench *r);
+int pipesize(int fd, int size);
+int splice(int fdin, int fdout, int n);
+int tee(int fdin, int fdout, int n);
+int copy_file_range(int fdin, int fdout, int n);
+int readv(int fd, const struct iovec *iov, int iovcnt);
+int writev(int fd, const struct iovec *iov, int iovcnt);
+int pread(int fd, void *buf, int n, int off);
+int pwrite(int fd, const void *buf, int n, int off);
+struct uring* uring_setup(void);
+int uring_enter(struct uring *r, int n);
 
 
 // ulib.c
@@ -47,12 +82,20 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
-int fgets(char *buf, unsigned int max, int fd);
-int getline(char **buf, int size, int fd);
+int ugetpid(void);
+uint uuptime(void);
+uint64 urtctime(void);
+const struct vdata *vdatapage(void);
 
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
+void fflush(int fd);
+void flushall(void);
+int getc(int fd);
+int ungetc(int c, int fd);
+int fgets(char *buf, unsigned int max, int fd);
+int getline(char **buf, uint *size, int fd);
 
 // umalloc.c
 void* malloc(uint);
@@ -66,16 +109,29 @@ void* realloc(void *, uint);
 
 int setnice(int);
 
-int mmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
+uint64 mmap(uint64 addr, int length, int prot, int flags, int fd, int offset);
 int munmap(uint64 addr, int length);
+int msync(uint64 addr, int length);
+int shm_open(const char *name, int size, int omode);
+int shm_unlink(const char *name);
+int clone(void (*fn)(void*), void *arg, void *stack);
+int join(int tid, int *status);
+int futex(int *addr, int op, int val);
+int kmemstat(struct kmemstat *st);
+int kmemstress(int n, int seed);
+int slabstat(struct slabstat *buf, int n);
 
-// mmap protection flags
-#define PROT_READ  1
-#define PROT_WRITE 2
-
-// mmap mapping flags
-#define MAP_ANON    1
-#define MAP_PRIVATE 2
+// pthread.c
+typedef struct pthread *pthread_t;
+typedef struct { volatile int v; } pthread_mutex_t;
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+int pthread_create(pthread_t *t, void *(*fn)(void*), void *arg);
+int pthread_join(pthread_t t, void **ret);
+void pthread_exit(void *ret) __attribute__((noreturn));
+// in ulib.c, for printf.c:
+int pthread_mutex_init(pthread_mutex_t *m);
+int pthread_mutex_lock(pthread_mutex_t *m);
+int pthread_mutex_unlock(pthread_mutex_t *m);
 
 
 int freemem(void); 
@@ -4,9 +4,16 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/uring.h"
+#include "kernel/mman.h"
+#include "kernel/vdata.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/rusage.h"
+#include "kernel/kmemstat.h"
+#include "kernel/slabstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -789,6 +796,1317 @@ pipe1(char *s)
 }
 
 
+// pipesize() grows a pipe, refuses to shrink it below its
+// contents, and keeps the data in order across a resize.
+void
+pipesizetest(char *s)
+{
+  int fds[2], i, n;
+  enum { SZ=3*PGSIZE };
+  static char data[SZ];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[0], 0) < PGSIZE){
+    printf("%s: default pipe size %d\n", s, pipesize(fds[0], 0));
+    exit(1);
+  }
+  if(pipesize(fds[1], 3*PGSIZE) != 4*PGSIZE){
+    printf("%s: pipesize did not round up to 4 pages\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    data[i] = i % 251;
+  // fits without a reader now.
+  if(write(fds[1], data, SZ) != SZ){
+    printf("%s: write to resized pipe failed\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[1], PGSIZE) != -1){
+    printf("%s: pipe shrank below its contents\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[0], 8*PGSIZE) != 8*PGSIZE){
+    printf("%s: could not grow a full pipe\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  for(i = 0; (n = read(fds[0], buf, 1000)) > 0; i += n){
+    for(int j = 0; j < n; j++){
+      if(buf[j] != (char)((i + j) % 251)){
+        printf("%s: wrong data at %d\n", s, i + j);
+        exit(1);
+      }
+    }
+  }
+  if(i != SZ){
+    printf("%s: read %d bytes, wanted %d\n", s, i, SZ);
+    exit(1);
+  }
+  close(fds[0]);
+  if(pipesize(0, PGSIZE) != -1){
+    printf("%s: pipesize of a non-pipe succeeded\n", s);
+    exit(1);
+  }
+}
+
+// splice() moves file data into a pipe and back out to a file,
+// and tee() copies pipe data without consuming it.
+void
+splicetest(char *s)
+{
+  int fd, p[2], q[2], i, n;
+  enum { SZ=3000 };
+
+  unlink("splice.in");
+  unlink("splice.out");
+  fd = open("splice.in", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create splice.in failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write splice.in failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(p) != 0 || pipe(q) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fd = open("splice.in", O_RDONLY);
+  if((n = splice(fd, p[1], SZ)) != SZ){
+    printf("%s: splice file->pipe moved %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, p[1], SZ) != 0){
+    printf("%s: splice at end of file not 0\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(splice(p[0], p[1], 1) != -1 || tee(p[0], p[1], 1) != -1){
+    printf("%s: splice/tee of a pipe to itself succeeded\n", s);
+    exit(1);
+  }
+  if((n = tee(p[0], q[1], SZ)) != SZ){
+    printf("%s: tee moved %d\n", s, n);
+    exit(1);
+  }
+  close(q[1]);
+
+  fd = open("splice.out", O_CREATE|O_RDWR);
+  close(p[1]);
+  for(i = 0; (n = splice(p[0], fd, SZ)) > 0; i += n)
+    ;
+  if(i != SZ){
+    printf("%s: splice pipe->file moved %d\n", s, i);
+    exit(1);
+  }
+  close(p[0]);
+  close(fd);
+
+  // the tee'd copy and the file must both match.
+  for(i = 0; (n = read(q[0], buf, sizeof(buf))) > 0; i += n){
+    for(int j = 0; j < n; j++){
+      if(buf[j] != 'a' + (i + j) % 26){
+        printf("%s: wrong tee data\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(q[0]);
+  if(i != SZ){
+    printf("%s: tee copy has %d bytes\n", s, i);
+    exit(1);
+  }
+  fd = open("splice.out", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != SZ){
+    printf("%s: splice.out has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: wrong splice.out data\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("splice.in");
+  unlink("splice.out");
+}
+
+// splices in opposite directions between two full pipes must
+// not stop a reader of either pipe from making room for them.
+void
+splicecrosstest(char *s)
+{
+  int a[2], b[2], pid[2], i, n, xstatus;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'x', PGSIZE);
+  if(write(a[1], buf, PGSIZE) != PGSIZE || write(b[1], buf, PGSIZE) != PGSIZE){
+    printf("%s: fill failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2; i++){
+    if((pid[i] = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid[i] == 0)
+      exit(i == 0 ? splice(a[0], b[1], PGSIZE) <= 0 : splice(b[0], a[1], PGSIZE) <= 0);
+  }
+  // give both splices time to block on their full destinations.
+  pause(5);
+  for(i = 0; i < PGSIZE; i += n){
+    if((n = read(b[0], buf, PGSIZE - i)) <= 0){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 2; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: splice failed\n", s);
+      exit(1);
+    }
+  }
+  close(a[0]); close(a[1]); close(b[0]); close(b[1]);
+}
+
+// copy_file_range() copies file data in the kernel, short at
+// end of file, and refuses to copy a file onto itself.
+void
+copyrangetest(char *s)
+{
+  int in, out, i, n, total;
+  enum { SZ=5000 };
+
+  unlink("crange.in");
+  unlink("crange.out");
+  in = open("crange.in", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 199;
+  if(in < 0 || write(in, buf, SZ) != SZ){
+    printf("%s: create crange.in failed\n", s);
+    exit(1);
+  }
+  if(copy_file_range(in, in, 10) != -1){
+    printf("%s: copied a file onto itself\n", s);
+    exit(1);
+  }
+  close(in);
+
+  in = open("crange.in", O_RDONLY);
+  out = open("crange.out", O_CREATE|O_RDWR);
+  // odd chunk size, to cross block boundaries.
+  for(total = 0; (n = copy_file_range(in, out, 777)) > 0; total += n)
+    ;
+  if(n < 0 || total != SZ){
+    printf("%s: copy_file_range copied %d\n", s, total);
+    exit(1);
+  }
+  close(in);
+  close(out);
+
+  out = open("crange.out", O_RDONLY);
+  memset(buf, 0, SZ);
+  if(read(out, buf, SZ + 1) != SZ){
+    printf("%s: crange.out has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != (char)(i % 199)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(out);
+  unlink("crange.in");
+  unlink("crange.out");
+}
+
+// writev()/readv() gather and scatter in order, and
+// pread()/pwrite() use their offset without moving the file's.
+void
+iovtest(char *s)
+{
+  struct iovec iov[3];
+  char a[5], b[7], c[3];
+  int fd;
+
+  unlink("iov.txt");
+  fd = open("iov.txt", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iov.txt failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = (char*)"hello";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = (char*)", ";
+  iov[1].iov_len = 2;
+  iov[2].iov_base = (char*)"world";
+  iov[2].iov_len = 5;
+  if(writev(fd, iov, 3) != 12){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "W", 1, 7) != 1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  // pwrite must not have moved the offset from 12.
+  if(write(fd, "!", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 6, 7) != 6 || memcmp(b, "World!", 6) != 0){
+    printf("%s: pread returned the wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 6, 100) != 0){
+    printf("%s: pread past end of file not 0\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iov.txt", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  iov[2].iov_base = c;
+  iov[2].iov_len = sizeof(c);
+  if(readv(fd, iov, 3) != 13){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(memcmp(a, "hello", 5) != 0 || memcmp(b, ", World", 7) != 0 || c[0] != '!'){
+    printf("%s: readv returned the wrong data\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, IOV_MAX + 1) != -1){
+    printf("%s: readv took too many buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iov.txt");
+}
+
+// a batch of pipe, write, read, fstat, open and close through
+// the uring_setup() ring runs in order, with one completion each.
+void
+uringtest(char *s)
+{
+  struct uring *r = uring_setup();
+  struct stat st;
+  int fds[2], i;
+  char out[6];
+
+  if(r == (struct uring*)-1 || uring_setup() != (struct uring*)-1){
+    printf("%s: uring_setup failed\n", s);
+    exit(1);
+  }
+  r->sq[0] = (struct uring_sqe){ .op = URING_PIPE, .addr = (uint64)fds, .user_data = 10 };
+  r->sq_tail = 1;
+  if(uring_enter(r, 1) != 1 || r->sq_head != 1 || r->cq_tail != 1 ||
+     r->cq[0].res != 0 || r->cq[0].user_data != 10){
+    printf("%s: uring pipe failed\n", s);
+    exit(1);
+  }
+
+  r->sq[1] = (struct uring_sqe){ .op = URING_WRITE, .fd = fds[1], .addr = (uint64)"uring", .len = 5, .user_data = 11 };
+  r->sq[2] = (struct uring_sqe){ .op = URING_READ, .fd = fds[0], .addr = (uint64)out, .len = 5, .user_data = 12 };
+  r->sq[3] = (struct uring_sqe){ .op = URING_FSTAT, .fd = 1, .addr = (uint64)&st, .user_data = 13 };
+  r->sq[4] = (struct uring_sqe){ .op = URING_CLOSE, .fd = fds[0], .user_data = 14 };
+  r->sq[5] = (struct uring_sqe){ .op = URING_CLOSE, .fd = fds[1], .user_data = 15 };
+  r->sq[6] = (struct uring_sqe){ .op = URING_OPEN, .addr = (uint64)"/nonexistent", .flags = O_RDONLY, .user_data = 16 };
+  r->sq[7] = (struct uring_sqe){ .op = 99, .user_data = 17 };
+  r->sq_tail = 8;
+  if(uring_enter(r, 100) != 7 || r->sq_head != 8 || r->cq_tail != 8){
+    printf("%s: uring_enter did not run the batch\n", s);
+    exit(1);
+  }
+  int want[] = { 0, 5, 5, 0, 0, 0, -1, -1 };
+  for(i = 1; i < 8; i++){
+    if(r->cq[i].user_data != 10 + i || r->cq[i].res != want[i]){
+      printf("%s: completion %d: res %d\n", s, i, r->cq[i].res);
+      exit(1);
+    }
+  }
+  if(memcmp(out, "uring", 5) != 0 || st.type != T_DEVICE){
+    printf("%s: uring read or fstat returned the wrong data\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "x", 1) != -1){
+    printf("%s: uring close did not close\n", s);
+    exit(1);
+  }
+  // only the ring uring_setup() made is accepted.
+  if(uring_enter((struct uring*)out, 1) != -1){
+    printf("%s: uring_enter took a ring it didn't make\n", s);
+    exit(1);
+  }
+
+  // a URING_CLOSE flushes what printf() buffered for the fd.
+  int fd = open("uringout", O_CREATE|O_WRONLY|O_TRUNC);
+  fprintf(fd, "uring");
+  r->sq[8] = (struct uring_sqe){ .op = URING_CLOSE, .fd = fd, .user_data = 18 };
+  r->sq_tail = 9;
+  if(fd < 0 || uring_enter(r, 1) != 1 || r->cq[8].res != 0){
+    printf("%s: uring close of a file failed\n", s);
+    exit(1);
+  }
+  memset(out, 0, sizeof(out));
+  fd = open("uringout", O_RDONLY);
+  if(read(fd, out, sizeof(out)) != 5 || memcmp(out, "uring", 5) != 0){
+    printf("%s: uring close lost buffered output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("uringout");
+}
+
+// the USYSCALL and VDATA pages agree with the system calls,
+// and user code can't write them.
+void
+vdatatest(char *s)
+{
+  int pid, xstatus;
+
+  if(ugetpid() != getpid()){
+    printf("%s: ugetpid %d, getpid %d\n", s, ugetpid(), getpid());
+    exit(1);
+  }
+  uint u0 = uptime();
+  uint v = uuptime();
+  uint u1 = uptime();
+  if(v < u0 || v > u1){
+    printf("%s: uuptime %d outside [%d, %d]\n", s, v, u0, u1);
+    exit(1);
+  }
+  // the calibrated clock should track the RTC to within 100ms,
+  // and never run backwards.
+  uint64 r = rtcgettime();
+  uint64 c = urtctime();
+  if(c + 100000000ULL < r || c > r + 100000000ULL){
+    printf("%s: urtctime is %lu ns off the RTC\n", s, c > r ? c - r : r - c);
+    exit(1);
+  }
+  for(int i = 0; i < 1000; i++){
+    uint64 c1 = urtctime();
+    if(c1 < c){
+      printf("%s: urtctime went backwards\n", s);
+      exit(1);
+    }
+    c = c1;
+  }
+  if(vdatapage()->ncpu < 1 || vdatapage()->ncpu > NCPU){
+    printf("%s: bad ncpu %d\n", s, vdatapage()->ncpu);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    if(ugetpid() != getpid()){
+      printf("%s: child ugetpid %d, getpid %d\n", s, ugetpid(), getpid());
+      exit(1);
+    }
+    *(volatile uint *)VDATA = 0;
+    printf("%s: wrote the VDATA page\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: VDATA write did not kill the child\n", s);
+    exit(1);
+  }
+}
+
+// buffered printf output to a pipe must stay in order with
+// direct write()s and be flushed by exit().
+void
+stdiotest(char *s)
+{
+  int fds[2], pid, n, tot;
+  static char buf[1024];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fprintf(fds[1], "a%d", 1);
+    fprintf(fds[1], "b\n");
+    write(fds[1], "c", 1);
+    fprintf(fds[1], "%lu", (uint64)0x123456789);
+    exit(0);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf + tot, sizeof(buf) - 1 - tot)) > 0)
+    tot += n;
+  buf[tot] = 0;
+  close(fds[0]);
+  wait(0);
+  if(strcmp(buf, "a1b\nc4886718345") != 0){
+    printf("%s: read \"%s\"\n", s, buf);
+    exit(1);
+  }
+}
+
+// the buffered line readers: short and long lines, a final line
+// without a newline, and ungetc.
+void
+fgetstest(char *s)
+{
+  int fd, i;
+  char buf[8];
+  char *line = 0;
+  uint size = 0;
+
+  fd = open("fgetstest", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fprintf(fd, "ab\n");
+  for(i = 0; i < 1000; i++)
+    fprintf(fd, "%c", 'a' + i % 26);
+  fprintf(fd, "\nend");
+  close(fd);
+
+  fd = open("fgetstest", O_RDONLY);
+  if(fgets(buf, sizeof(buf), fd) != 3 || strcmp(buf, "ab\n") != 0){
+    printf("%s: fgets short line\n", s);
+    exit(1);
+  }
+  if(getc(fd) != 'a' || ungetc('x', fd) != 'x' || getc(fd) != 'x'){
+    printf("%s: getc/ungetc\n", s);
+    exit(1);
+  }
+  if(getline(&line, &size, fd) != 1000 || size < 1001 ||
+     line[0] != 'b' || line[998] != 'l' || line[999] != '\n'){
+    printf("%s: getline long line\n", s);
+    exit(1);
+  }
+  if(getline(&line, &size, fd) != 3 || strcmp(line, "end") != 0){
+    printf("%s: getline last line\n", s);
+    exit(1);
+  }
+  if(getline(&line, &size, fd) != -1 || fgets(buf, sizeof(buf), fd) != -1){
+    printf("%s: no EOF\n", s);
+    exit(1);
+  }
+  close(fd);
+  free(line);
+  unlink("fgetstest");
+}
+
+// anonymous mmap: multi-page, lazy, private across fork,
+// placed without overlap, partially unmappable, read-only.
+void
+mmaptest(char *s)
+{
+  int pid, xstatus, n = 8;
+  char *a, *b;
+
+  int free0 = freemem();
+  a = (char*)mmap(0, n*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+  b = (char*)mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+  if(a == (char*)-1 || b == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(a < b + 3*PGSIZE && b < a + n*PGSIZE){
+    printf("%s: mappings overlap\n", s);
+    exit(1);
+  }
+  if(freemem() < free0){
+    printf("%s: mmap allocated memory up front\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++){
+    if(a[i*PGSIZE] != 0){
+      printf("%s: page %d not zeroed\n", s, i);
+      exit(1);
+    }
+    a[i*PGSIZE] = 'a' + i;
+  }
+
+  // the child gets its own copy.
+  pid = fork();
+  if(pid == 0){
+    a[0] = 'X';
+    exit(a[PGSIZE] == 'b' ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 'a'){
+    printf("%s: fork copy wrong\n", s);
+    exit(1);
+  }
+
+  // punch a hole; both sides keep their data.
+  if(munmap((uint64)a + 2*PGSIZE, 2*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(a[PGSIZE] != 'b' || a[4*PGSIZE] != 'e'){
+    printf("%s: munmap lost data\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    a[2*PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: unmapped page accessible\n", s);
+    exit(1);
+  }
+
+  // a read-only mapping reads as zero and can't be written.
+  char *ro = (char*)mmap(0, PGSIZE, PROT_READ, MAP_ANON|MAP_PRIVATE, -1, 0);
+  pid = fork();
+  if(pid == 0){
+    if(ro[10] != 0)
+      exit(1);
+    ro[10] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: read-only mapping writable\n", s);
+    exit(1);
+  }
+
+  munmap((uint64)a, n*PGSIZE);
+  munmap((uint64)b, 3*PGSIZE);
+  munmap((uint64)ro, PGSIZE);
+  // allow for the page-table pages the faults allocated.
+  if(freemem() < free0 - 3*PGSIZE/1024){
+    printf("%s: munmap leaked memory\n", s);
+    exit(1);
+  }
+}
+
+// reads of lazily allocated memory map the shared zero page;
+// the first write to a page gives it a page of its own.
+void
+zeropagetest(char *s)
+{
+  int n = 64, i, pid, xstatus, free0;
+  uint64 z0;
+  char *a;
+
+  free0 = freemem();
+  z0 = vdatapage()->nzero;
+  a = sbrklazy((n+1)*PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  a = (char*)PGROUNDUP((uint64)a);
+  for(i = 0; i < n; i++){
+    if(a[i*PGSIZE + i] != 0){
+      printf("%s: page %d not zero\n", s, i);
+      exit(1);
+    }
+  }
+  if(vdatapage()->nzero - z0 < n){
+    printf("%s: zero page counted %d reads, not %d\n", s,
+           (int)(vdatapage()->nzero - z0), n);
+    exit(1);
+  }
+  // allow for the page-table pages the faults allocated.
+  if(freemem() < free0 - 4*PGSIZE/1024){
+    printf("%s: reads allocated memory\n", s);
+    exit(1);
+  }
+
+  a[5*PGSIZE] = 'x';
+  if(a[5*PGSIZE] != 'x' || a[4*PGSIZE] != 0 || a[6*PGSIZE] != 0){
+    printf("%s: write to zero page leaked\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    a[6*PGSIZE] = 'y';
+    exit(a[5*PGSIZE] == 'x' && a[6*PGSIZE] == 'y' && a[7*PGSIZE] == 0 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[6*PGSIZE] != 0){
+    printf("%s: zero page wrong after fork\n", s);
+    exit(1);
+  }
+  sbrk(-(n+1)*PGSIZE);
+}
+
+// a sequential sweep of lazily allocated heap memory maps
+// several pages per fault; every page still starts out zeroed.
+void
+faultaroundtest(char *s)
+{
+  int n = 64, i;
+  struct rusage r0, r1;
+  char *a;
+
+  a = sbrklazy((n+1)*PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrklazy failed\n", s);
+    exit(1);
+  }
+  a = (char*)PGROUNDUP((uint64)a);
+  getrusage(RUSAGE_SELF, &r0);
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE] = i;
+  getrusage(RUSAGE_SELF, &r1);
+  for(i = 0; i < n; i++){
+    if(a[i*PGSIZE] != (char)i || a[i*PGSIZE + PGSIZE - 1] != 0){
+      printf("%s: page %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(r1.nfault - r0.nfault >= n/2){
+    printf("%s: %d faults for %d pages\n", s, (int)(r1.nfault - r0.nfault), n);
+    exit(1);
+  }
+  sbrk(-(n+1)*PGSIZE);
+}
+
+// a large eager sbrk() gets 2MB megapages where it can; they
+// must behave like pages when forked and when partly freed.
+void
+megapagetest(char *s)
+{
+  int n = 3*512, i, pid, xstatus;
+  char *a, *top;
+
+  top = sbrk(0);
+  a = sbrk((n+512)*PGSIZE);
+  if(a == SBRK_ERROR){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)MEGAROUNDUP((uint64)a);
+  for(i = 0; i < n; i++)
+    a[i*PGSIZE + i % PGSIZE] = i;
+
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(a[i*PGSIZE + i % PGSIZE] != (char)i)
+        exit(1);
+      a[i*PGSIZE + i % PGSIZE] = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+
+  // free the top of the middle megapage, splitting it.
+  sbrk(-(int)((top + (n+512)*PGSIZE) - (a + 512*PGSIZE + 100*PGSIZE)));
+  for(i = 0; i < 512 + 100; i++){
+    if(a[i*PGSIZE + i % PGSIZE] != (char)i){
+      printf("%s: page %d lost its data\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-(int)(sbrk(0) - top));
+}
+
+// several processes at once allocate and free physical blocks
+// of mixed orders in the kernel; no block may be handed out
+// twice, and once they are done the buddies must merge back.
+// Needs a kernel built with KMEMSTRESS=1.
+void
+buddytest(char *s)
+{
+  struct kmemstat st0, st;
+  int free0, i, pid, xstatus;
+
+  if(kmemstress(0, 0) < 0){
+    printf("%s: no kmemstress() in this kernel, skipped\n", s);
+    return;
+  }
+  free0 = freemem();
+  if(kmemstat(&st0) < 0){
+    printf("%s: kmemstat failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(kmemstress(2000, i + 1) < 0 ? 1 : 0);
+  }
+  for(i = 0; i < 3; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: kmemstress found a corrupt block\n", s);
+      exit(1);
+    }
+  }
+  kmemstat(&st);
+  if(st.nmerge == st0.nmerge || st.nsplit == st0.nsplit){
+    printf("%s: no splits or merges\n", s);
+    exit(1);
+  }
+  if(freemem() < free0 - 4*PGSIZE/1024){
+    printf("%s: lost memory: %d KiB free, was %d\n", s, freemem(), free0);
+    exit(1);
+  }
+}
+
+// objects live in a slab cache; returns how many of the cache
+// called name are in use, or -1.
+int
+slablive(char *name)
+{
+  struct slabstat st[8];
+  int i, n;
+
+  n = slabstat(st, 8);
+  for(i = 0; i < n; i++)
+    if(strcmp(st[i].name, name) == 0)
+      return st[i].ninuse - st[i].nmag;
+  return -1;
+}
+
+// files and pipes come from slab caches, so more files can be
+// open at once than the 100 the old fixed table held, and they
+// go back to their caches when closed.
+void
+slabtest(char *s)
+{
+  int ready[2], go[2], fds[2], i, j, n = 12, pid, xstatus, bad = 0;
+  int files0, pipes0;
+  char c;
+
+  files0 = slablive("file");
+  pipes0 = slablive("pipe");
+  if(files0 < 0 || pipes0 < 0){
+    printf("%s: no file or pipe cache\n", s);
+    exit(1);
+  }
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      // fill the rest of the fd table with pipes.
+      for(j = 0; j < 5; j++){
+        if(pipe(fds) < 0){
+          write(ready[1], "x", 1);
+          exit(1);
+        }
+      }
+      write(ready[1], "o", 1);
+      read(go[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < n; i++)
+    if(read(ready[0], &c, 1) != 1 || c != 'o')
+      bad = 1;
+  close(go[1]);
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      bad = 1;
+  }
+  close(ready[0]);
+  if(bad){
+    printf("%s: could not open %d files\n", s, n*10);
+    exit(1);
+  }
+  if(slablive("file") != files0 || slablive("pipe") != pipes0){
+    printf("%s: files or pipes not freed\n", s);
+    exit(1);
+  }
+}
+
+// write() racing msync() of the same dirty MAP_SHARED page:
+// every write() must reach the mapping, and survive the
+// write-backs into the file.
+void
+mmapsynctest(char *s)
+{
+  int fd, pid, xstatus, i, n = 200;
+  char *a, c;
+  static char data[PGSIZE];
+
+  unlink("mmapsync");
+  fd = open("mmapsync", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, PGSIZE) != PGSIZE){
+    printf("%s: create mmapsync failed\n", s);
+    exit(1);
+  }
+  a = (char*)mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // keep the page dirty and being written back.
+    for(i = 0; i < 4*n; i++){
+      a[PGSIZE-1] = i;
+      if(msync((uint64)a, PGSIZE) < 0)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < n; i++){
+    c = 'a' + i % 26;
+    if(pwrite(fd, &c, 1, i) != 1){
+      printf("%s: pwrite failed\n", s);
+      exit(1);
+    }
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: msync failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(a[i] != 'a' + i % 26){
+      printf("%s: write at %d lost from the mapping\n", s, i);
+      exit(1);
+    }
+  }
+  munmap((uint64)a, PGSIZE);
+  close(fd);
+
+  fd = open("mmapsync", O_RDONLY);
+  if(fd < 0 || read(fd, data, PGSIZE) != PGSIZE){
+    printf("%s: reopen mmapsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapsync");
+  for(i = 0; i < n; i++){
+    if(data[i] != 'a' + i % 26){
+      printf("%s: write at %d lost from the file\n", s, i);
+      exit(1);
+    }
+  }
+}
+
+// file-backed mmap: pages come from the file; MAP_PRIVATE stores
+// stay private, MAP_SHARED stores reach the file via msync() and
+// munmap(), and are shared with children; write()s show through.
+void
+fmmaptest(char *s)
+{
+  int fd, pid, xstatus, i, sz = 2*PGSIZE + 100;
+  char *a, buf[16];
+  static char data[2*PGSIZE + 100];
+
+  for(i = 0; i < sz; i++)
+    data[i] = 'A' + i / PGSIZE;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, sz) != sz){
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // private: the file's data, writable, but not written back.
+  fd = open("mmapfile", O_RDONLY);
+  if(mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (uint64)-1){
+    printf("%s: shared writable mapping of read-only fd\n", s);
+    exit(1);
+  }
+  a = (char*)mmap(0, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(a == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(a[0] != 'A' || a[PGSIZE] != 'B' || a[sz-1] != 'C' || a[sz] != 0){
+    printf("%s: private mapping has wrong data\n", s);
+    exit(1);
+  }
+  a[1] = 'x';
+  munmap((uint64)a, sz);
+
+  // shared: a child's store is seen by the parent, and by read()
+  // after msync().
+  fd = open("mmapfile", O_RDWR);
+  a = (char*)mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(a[1] != 'A'){
+    printf("%s: private store reached the file\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    a[PGSIZE] = 'y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[PGSIZE] != 'y'){
+    printf("%s: shared store not shared\n", s);
+    exit(1);
+  }
+  if(msync((uint64)a, sz) < 0){
+    printf("%s: msync failed\n", s);
+    exit(1);
+  }
+  if(read(fd, data, sz) != sz || data[PGSIZE] != 'y'){
+    printf("%s: msync didn't write back\n", s);
+    exit(1);
+  }
+
+  // write() shows through; munmap() writes back.
+  if(pwrite(fd, "z", 1, 2) != 1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(a[2] != 'z'){
+    printf("%s: write not seen by mapping\n", s);
+    exit(1);
+  }
+  a[3] = 'w';
+  munmap((uint64)a, sz);
+  if(pread(fd, buf, 4, 0) != 4 || buf[2] != 'z' || buf[3] != 'w'){
+    printf("%s: munmap didn't write back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+}
+
+// shared memory: MAP_SHARED|MAP_ANON pages are shared with a
+// child, even ones first touched after fork(), and a named
+// segment carries a producer/consumer ring between processes.
+#define RINGSZ 4096
+struct ring {
+  volatile uint head;   // bytes produced
+  volatile uint tail;   // bytes consumed
+  char buf[RINGSZ];
+};
+
+void
+shmtest(char *s)
+{
+  int pid, xstatus, fd, i, n = 64*1024;
+  struct ring *r;
+  char *a;
+
+  a = (char*)mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap shared anon failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  pid = fork();
+  if(pid == 0){
+    a[0] = 2;
+    a[PGSIZE] = 3;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 2 || a[PGSIZE] != 3){
+    printf("%s: shared anon memory not shared\n", s);
+    exit(1);
+  }
+  munmap((uint64)a, 2*PGSIZE);
+
+  shm_unlink("ut-ring");
+  if((fd = shm_open("ut-ring", sizeof(struct ring), O_CREATE|O_RDWR)) < 0){
+    printf("%s: shm_open create failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    // the producer finds the segment by name.
+    close(fd);
+    fd = shm_open("ut-ring", 0, O_RDWR);
+    r = (struct ring*)mmap(0, sizeof(*r), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(fd < 0 || r == (struct ring*)-1)
+      exit(1);
+    for(i = 0; i < n; i++){
+      while(r->head - r->tail == RINGSZ)
+        nanosleep(10000);
+      r->buf[r->head % RINGSZ] = i % 251;
+      __sync_synchronize();
+      r->head++;
+    }
+    exit(0);
+  }
+  r = (struct ring*)mmap(0, sizeof(*r), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(r == (struct ring*)-1){
+    printf("%s: mmap segment failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    while(r->head == r->tail)
+      nanosleep(10000);
+    __sync_synchronize();
+    if(r->buf[r->tail % RINGSZ] != (char)(i % 251)){
+      printf("%s: ring byte %d wrong\n", s, i);
+      exit(1);
+    }
+    __sync_synchronize();
+    r->tail++;
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: producer failed\n", s);
+    exit(1);
+  }
+  munmap((uint64)r, sizeof(*r));
+  close(fd);
+  if(shm_unlink("ut-ring") < 0 || shm_open("ut-ring", 0, O_RDWR) >= 0){
+    printf("%s: shm_unlink failed\n", s);
+    exit(1);
+  }
+}
+
+#define NTHR 4
+#define THRN 10000
+
+static pthread_mutex_t thrmu = PTHREAD_MUTEX_INITIALIZER;
+static int thrcount;
+
+// Fill this thread's part of the shared array, and bump the
+// shared counter under the mutex.
+static void*
+thrwork(void *arg)
+{
+  int *a = arg;
+  int i;
+
+  for(i = 0; i < THRN; i++){
+    a[i] = i;
+    pthread_mutex_lock(&thrmu);
+    thrcount++;
+    pthread_mutex_unlock(&thrmu);
+  }
+  return arg;
+}
+
+static void*
+thrpid(void *arg)
+{
+  return (void*)(uint64)(getpid() == ugetpid() ? getpid() : -1);
+}
+
+static void*
+thrspin(void *arg)
+{
+  for(;;)
+    *(volatile int*)arg += 1;
+  return 0;
+}
+
+// threads share the address space and the pid, the mutex
+// works, and exit() in the main thread ends the others.
+void
+threadstest(char *s)
+{
+  pthread_t t[NTHR];
+  void *ret;
+  int *a, i, pid, xstatus;
+  volatile int spin = 0;
+
+  thrcount = 0;
+  a = malloc(NTHR*THRN*sizeof(int));
+  for(i = 0; i < NTHR; i++){
+    if(pthread_create(&t[i], thrwork, a + i*THRN) < 0){
+      printf("%s: pthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++){
+    if(pthread_join(t[i], &ret) < 0 || ret != a + i*THRN){
+      printf("%s: pthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(thrcount != NTHR*THRN){
+    printf("%s: count %d, not %d\n", s, thrcount, NTHR*THRN);
+    exit(1);
+  }
+  for(i = 0; i < NTHR*THRN; i++){
+    if(a[i] != i % THRN){
+      printf("%s: a[%d] is %d\n", s, i, a[i]);
+      exit(1);
+    }
+  }
+  free(a);
+
+  // a thread has its process's pid, by either call.
+  if(pthread_create(&t[0], thrpid, 0) < 0 || pthread_join(t[0], &ret) < 0 ||
+     (uint64)ret != getpid()){
+    printf("%s: thread getpid %d, not %d\n", s, (int)(uint64)ret, getpid());
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    if(pthread_create(&t[0], thrspin, (void*)&spin) < 0)
+      exit(1);
+    while(spin == 0)
+      ;
+    // no exec() while another thread runs.
+    if(exec("echo", (char*[]){ "echo", 0 }) >= 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: thread exit/exec failed\n", s);
+    exit(1);
+  }
+}
+
+static void*
+thrfds(void *arg)
+{
+  int fd;
+
+  // the main thread's fd is the thread's too.
+  if(close((int)(uint64)arg) < 0)
+    return (void*)-1;
+  if(chdir("thrfds.dir") < 0)
+    return (void*)-1;
+  if((fd = open("f", O_CREATE|O_RDWR)) < 0)
+    return (void*)-1;
+  return (void*)(uint64)fd;
+}
+
+// threads share the file descriptor table and the current
+// directory.
+void
+threadfds(char *s)
+{
+  pthread_t t;
+  void *ret;
+  int fd, fd1;
+  char buf[4];
+
+  if(mkdir("thrfds.dir") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if((fd1 = open("thrfds.dir", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(pthread_create(&t, thrfds, (void*)(uint64)fd1) < 0 ||
+     pthread_join(t, &ret) < 0 || (int)(uint64)ret < 0){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  fd = (int)(uint64)ret;
+  if(close(fd1) == 0){
+    printf("%s: thread's close() didn't close fd %d\n", s, fd1);
+    exit(1);
+  }
+  if(write(fd, "abc", 3) != 3){
+    printf("%s: write to thread's fd %d failed\n", s, fd);
+    exit(1);
+  }
+  close(fd);
+  // the thread's chdir() moved the process.
+  if((fd = open("f", O_RDONLY)) < 0 || read(fd, buf, 3) != 3 ||
+     memcmp(buf, "abc", 3) != 0){
+    printf("%s: cwd not shared\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("f");
+  if(chdir("..") < 0 || unlink("thrfds.dir") < 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
+static volatile int thrstores;
+
+static void*
+thrstore(void *arg)
+{
+  for(;;){
+    *(volatile int*)arg = 1;
+    thrstores++;
+  }
+  return 0;
+}
+
+// munmap() in one thread cuts off another thread that is
+// storing to the page on another hart, rather than leaving it
+// writing to the freed page through a stale TLB entry.
+void
+threadunmap(char *s)
+{
+  pthread_t t;
+  char *a;
+  int n, pid, xstatus;
+
+  pid = fork();
+  if(pid == 0){
+    a = (char*)mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+    if(a == (char*)-1 || pthread_create(&t, thrstore, a) < 0)
+      exit(1);
+    while(thrstores == 0)
+      ;
+    if(munmap((uint64)a, PGSIZE) < 0)
+      exit(1);
+    pause(2);
+    n = thrstores;
+    pause(2);
+    exit(thrstores == n ? 0 : 2);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: %s\n", s, xstatus == 2 ? "thread still stores" : "failed");
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -1919,6 +3237,8 @@ dirfile(char *s)
   close(fd);
 }
 
+#define NIREF 51  // more than the inode table used to hold
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
@@ -1926,7 +3246,7 @@ iref(char *s)
 {
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -1948,7 +3268,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2698,6 +4018,31 @@ lazy_copy(char *s)
   exit(0);
 }
 
+// does nanosleep() sleep at least as long as asked, with
+// sub-tick resolution, and not wildly longer?
+void
+nanosleeptest(char *s)
+{
+  if(nanosleep(1) != 0){
+    printf("%s: nanosleep(1) failed\n", s);
+    exit(1);
+  }
+
+  int t0 = uptime();
+  // 25 x 10ms = 2.5 ticks.
+  for(int i = 0; i < 25; i++){
+    if(nanosleep(10 * 1000000ULL) != 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  int elapsed = uptime() - t0;
+  if(elapsed < 2 || elapsed > 20){
+    printf("%s: 250ms of nanosleep took %d ticks\n", s, elapsed);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2721,6 +4066,27 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipesizetest, "pipesize"},
+  {splicetest, "splice"},
+  {splicecrosstest, "splicecross"},
+  {copyrangetest, "copyrange"},
+  {iovtest, "iov"},
+  {uringtest, "uring"},
+  {vdatatest, "vdata"},
+  {stdiotest, "stdio"},
+  {fgetstest, "fgets"},
+  {mmaptest, "mmap"},
+  {zeropagetest, "zeropage"},
+  {faultaroundtest, "faultaround"},
+  {megapagetest, "megapage"},
+  {buddytest, "buddy"},
+  {slabtest, "slab"},
+  {fmmaptest, "fmmap"},
+  {mmapsynctest, "mmapsync"},
+  {shmtest, "shm"},
+  {threadstest, "threads"},
+  {threadfds, "threadfds"},
+  {threadunmap, "threadunmap"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2765,6 +4131,7 @@ struct test {
   {lazy_alloc, "lazy_alloc"},
   {lazy_unmap, "lazy_unmap"},
   {lazy_copy, "lazy_copy"},
+  {nanosleeptest, "nanosleep"},
   { 0, 0},
 };
 
@@ -9,7 +9,8 @@ print "#include \"kernel/syscall.h\"\n";
 sub entry {
     my $prefix = "sys_";
     my $name = shift;
-    if ($name eq "sbrk") {
+    # these have C wrappers in ulib.c (sbrk) or printf.c.
+    if ($name =~ /^(sbrk|fork|exit|exec|write|close|uring_enter)$/) {
 	print ".global $prefix$name\n";
 	print "$prefix$name:\n";
     } else {
@@ -52,3 +53,31 @@ entry("setnice");
 entry("freemem");
 entry("mmap");
 entry("munmap");
+entry("cpuidle");
+entry("nanosleep");
+entry("setquantum");
+entry("wait3");
+entry("getrusage");
+entry("profctl");
+entry("profread");
+entry("lockstat");
+entry("lockbench");
+entry("pipesize");
+entry("splice");
+entry("tee");
+entry("copy_file_range");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("uring_enter");
+entry("msync");
+entry("shm_open");
+entry("shm_unlink");
+entry("clone");
+entry("join");
+entry("futex");
+entry("kmemstat");
+entry("kmemstress");
+entry("slabstat");
+entry("uring_setup");
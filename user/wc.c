@@ -1,35 +1,50 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/mman.h"
 #include "user/user.h"
 
-char buf[512];
+int l, w, c, inword;
+
+void
+count(int ch)
+{
+  c++;
+  if(ch == '\n')
+    l++;
+  if(strchr(" \r\t\n\v", ch))
+    inword = 0;
+  else if(!inword){
+    w++;
+    inword = 1;
+  }
+}
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
-  int l, w, c, inword;
+  struct stat st;
+  uint64 addr;
+  char *p;
+  int ch, i;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+  // scan regular files in place rather than read() them.
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0 &&
+     (addr = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) != (uint64)-1){
+    p = (char*)addr;
+    for(i = 0; i < st.size; i++)
+      count(p[i]);
+    munmap(addr, st.size);
+  } else {
+    while((ch = getc(fd)) >= 0)
+      count(ch);
+    if(ch == -2){
+      printf("wc: read error\n");
+      exit(1);
     }
   }
-  if(n < 0){
-    printf("wc: read error\n");
-    exit(1);
-  }
   printf("%d %d %d %s\n", l, w, c, name);
 }
 